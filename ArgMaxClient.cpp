@@ -16,6 +16,7 @@
  *
  */
 
+#include <chrono>
 #include <iostream>
 #include <sstream>
 #include <stdint.h>
@@ -26,46 +27,102 @@
 
 using namespace std;
 
-static void RunProtocol(CSocket* socket, byte* input, void* args) {
-  clock_t startTime = clock();
+// Prints the outputs of an ARGMAX circuit of the given type, which are
+// either a bit per element or an index, followed by the max.
+static void PrintOutput(int* outputVals, uint32_t nOutputWires, uint32_t nBits, ArgMaxCircuitType type) {
+  uint32_t nArgOutputs = nOutputWires - nBits;
+  cout << endl << "output: ";
+  if (type == ARGMAX_INDEX) {
+    int index = 0;
+    for (int i = nArgOutputs - 1; i >= 0; i--) {
+      index = (index << 1) | outputVals[i];
+    }
+    cout << index << " ";
+  } else {
+    for (int i = 0; i < nArgOutputs; i++) {
+      if (outputVals[i] == 1) {
+        cout << i << " ";
+      }
+    }
+  }
+  int maxVal = 0;
+  for (int i = nOutputWires - 1; i >= (int) nArgOutputs; i--) {
+    maxVal <<= 1;
+    if (outputVals[i] == 1) {
+      maxVal |= 1;
+    }
+  }
+  cout << " (" << maxVal << ")" << endl << endl;
+}
+
+static void RunProtocol(Connection* connection, byte* input, void* args) {
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
 
   uint32_t nElems = ((ArgMaxArgs*) args)->nElems;
   uint32_t nBits  = ((ArgMaxArgs*) args)->nBits;
+  ArgMaxCircuitType type = ((ArgMaxArgs*) args)->type;
+  uint32_t chunkSize = ((ArgMaxArgs*) args)->chunkSize;
+  CircuitShape shape = ((ArgMaxArgs*) args)->shape;
+  bool streamed = ((ArgMaxArgs*) args)->streamed;
 
   uint32_t nClientInputWires = nElems * nBits;
   uint32_t nInputWires = 2 * nClientInputWires;
-  uint32_t nOutputWires = nElems + nBits;
+  uint32_t nOutputWires = ArgMaxOutputWires(nElems, nBits, type);
 
-  GarbledCircuit circuit;
-  CreateArgMaxCircuit(circuit, nElems, nBits);
+  if (chunkSize > 0) {
+    // the final state starts with the outputs of ARGMAX_INDEX
+    ChunkedOp op = ArgMaxOp(nElems, nBits, shape);
+    int* outputVals = new int[op.stateBits];
+    long nAndGates;
+    RunChunkedClientProtocol(connection, op, input, outputVals, nElems, chunkSize, &nAndGates);
 
-  int* outputVals = new int[nOutputWires];
-  RunClientProtocol(socket, circuit, input, outputVals, nInputWires, nClientInputWires, nOutputWires);
+    double timeElapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
 
-  double timeElapsed = (double)(clock() - startTime) / CLOCKS_PER_SEC;
+    PrintOutput(outputVals, nOutputWires, nBits, type);
 
-  cout << endl << "output: ";
-  for (int i = 0; i < nElems; i++) {
-    if (outputVals[i] == 1) {
-      cout << i << " ";
-    }
+    cout << "Number of elements:  " << nElems << endl;
+    PrintStatistics(connection, nAndGates, timeElapsed);
+
+    delete[] outputVals;
+    return;
   }
-  int maxVal = 0;
-  for (int i = nOutputWires - 1; i >= nElems; i--) {
-    maxVal <<= 1;
-    if (outputVals[i] == 1) {
-      maxVal |= 1;
-    }
+
+  if (streamed) {
+    int* outputVals = new int[nOutputWires];
+    long nAndGates;
+    RunStreamedClientProtocol(connection, StreamedArgMaxOp(nElems, nBits, shape), input, outputVals,
+                              nClientInputWires, &nAndGates);
+
+    double timeElapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    PrintOutput(outputVals, nOutputWires, nBits, type);
+
+    cout << "Number of elements:  " << nElems << endl;
+    PrintStatistics(connection, nAndGates, timeElapsed);
+
+    delete[] outputVals;
+    return;
   }
-  cout << " (" << maxVal << ")" << endl << endl;
+
+  Circuit circuit;
+  CreateArgMaxCircuit(*circuit, nElems, nBits, type, shape);
+
+  int* outputVals = new int[nOutputWires];
+  RunClientProtocol(connection, *circuit, input, outputVals, nInputWires, nClientInputWires, nOutputWires);
+
+  double timeElapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+  PrintOutput(outputVals, nOutputWires, nBits, type);
 
   cout << "Number of elements:  " << nElems << endl;
-  PrintStatistics(socket, circuit, timeElapsed);
+  PrintStatistics(connection, *circuit, timeElapsed);
+
+  delete[] outputVals;
 }
 
 int main(int argc, const char** argv) {
   if (argc < 4) {
-    cout << "usage: ./ArgMaxClient input nElems nBits [port]" << endl;
+    cout << "usage: ./ArgMaxClient input nElems nBits [port [linear|tree|index|streamed [chunkSize [chain|brent-kung|sklansky]]]]" << endl;
     return 1;
   }
 
@@ -77,6 +134,49 @@ int main(int argc, const char** argv) {
     port = atoi(argv[4]);
   }
 
+  // "linear" (the default) and "tree" output every element that attains the
+  // max, "index" only the first. "streamed" outputs as "linear", but builds
+  // the circuit while it runs it.
+  ArgMaxCircuitType type = ARGMAX_LINEAR;
+  bool streamed = false;
+  if (argc > 5) {
+    if (string(argv[5]) == "tree") {
+      type = ARGMAX_TREE;
+    } else if (string(argv[5]) == "index") {
+      type = ARGMAX_INDEX;
+    } else if (string(argv[5]) == "streamed") {
+      streamed = true;
+    } else if (string(argv[5]) != "linear") {
+      cout << "unknown output mode " << argv[5] << endl;
+      return 1;
+    }
+  }
+
+  // a chunk size runs ARGMAX chunkSize elements at a time, which only the
+  // index output supports
+  uint32_t chunkSize = 0;
+  if (argc > 6) {
+    chunkSize = atoi(argv[6]);
+  }
+  if (chunkSize > 0 && type != ARGMAX_INDEX) {
+    cout << "a chunk size requires the index output mode" << endl;
+    return 1;
+  }
+
+  // the adders and comparisons: "chain" (the default) has the fewest AND
+  // gates, "brent-kung" and "sklansky" have logarithmic depth
+  CircuitShape shape = SHAPE_CHAIN;
+  if (argc > 7) {
+    if (string(argv[7]) == "brent-kung") {
+      shape = SHAPE_BRENT_KUNG;
+    } else if (string(argv[7]) == "sklansky") {
+      shape = SHAPE_SKLANSKY;
+    } else if (string(argv[7]) != "chain") {
+      cout << "unknown circuit shape " << argv[7] << endl;
+      return 1;
+    }
+  }
+
   byte* input = new byte[nElems*nBits];
   if (!ReadInputFile(input, inputFile, nElems * nBits)) {
     ClientLog("unable to read from input file");
@@ -84,7 +184,7 @@ int main(int argc, const char** argv) {
   }
   ClientLog("finished reading input");
 
-  ArgMaxArgs args(nElems, nBits);
+  ArgMaxArgs args(nElems, nBits, type, chunkSize, shape, streamed);
   StartClient("127.0.0.1", port, input, &args, RunProtocol);
 
   delete[] input;
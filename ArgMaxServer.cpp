@@ -26,24 +26,42 @@
 
 using namespace std;
 
-static void RunProtocol(CSocket* socket, byte* input, void* args) {
+static void RunProtocol(Connection* connection, byte* input, void* args) {
   uint32_t nElems = ((ArgMaxArgs*) args)->nElems;
   uint32_t nBits  = ((ArgMaxArgs*) args)->nBits;
+  ArgMaxCircuitType type = ((ArgMaxArgs*) args)->type;
+  uint32_t chunkSize = ((ArgMaxArgs*) args)->chunkSize;
+  CircuitShape shape = ((ArgMaxArgs*) args)->shape;
+  bool streamed = ((ArgMaxArgs*) args)->streamed;
+
+  if (chunkSize > 0) {
+    if (!RunChunkedServerProtocol(connection, ArgMaxOp(nElems, nBits, shape), input, nElems, chunkSize)) {
+      ServerLog("protocol execution failed");
+    }
+    return;
+  }
 
   uint32_t nServerInputWires = nElems * nBits;
   uint32_t nInputWires = 2 * nServerInputWires;
 
-  GarbledCircuit circuit;
-  CreateArgMaxCircuit(circuit, nElems, nBits);
+  if (streamed) {
+    if (!RunStreamedServerProtocol(connection, StreamedArgMaxOp(nElems, nBits, shape), input, nServerInputWires)) {
+      ServerLog("protocol execution failed");
+    }
+    return;
+  }
+
+  Circuit circuit;
+  CreateArgMaxCircuit(*circuit, nElems, nBits, type, shape);
 
-  if (!RunServerProtocol(socket, circuit, input, nInputWires, nServerInputWires)) {
+  if (!RunServerProtocol(connection, *circuit, input, nInputWires, nServerInputWires)) {
     ServerLog("protocol execution failed");
   }
 }
 
 int main(int argc, char** argv) {
   if (argc < 4) {
-    cout << "usage: ./ArgMaxServer input nElems nBits [port]" << endl;
+    cout << "usage: ./ArgMaxServer input nElems nBits [port [linear|tree|index|streamed [chunkSize [chain|brent-kung|sklansky]]]]" << endl;
     return 1;
   }
 
@@ -55,6 +73,49 @@ int main(int argc, char** argv) {
     port = atoi(argv[4]);
   }
 
+  // "linear" (the default) and "tree" output every element that attains the
+  // max, "index" only the first. "streamed" outputs as "linear", but builds
+  // the circuit while it runs it.
+  ArgMaxCircuitType type = ARGMAX_LINEAR;
+  bool streamed = false;
+  if (argc > 5) {
+    if (string(argv[5]) == "tree") {
+      type = ARGMAX_TREE;
+    } else if (string(argv[5]) == "index") {
+      type = ARGMAX_INDEX;
+    } else if (string(argv[5]) == "streamed") {
+      streamed = true;
+    } else if (string(argv[5]) != "linear") {
+      cout << "unknown output mode " << argv[5] << endl;
+      return 1;
+    }
+  }
+
+  // a chunk size runs ARGMAX chunkSize elements at a time, which only the
+  // index output supports
+  uint32_t chunkSize = 0;
+  if (argc > 6) {
+    chunkSize = atoi(argv[6]);
+  }
+  if (chunkSize > 0 && type != ARGMAX_INDEX) {
+    cout << "a chunk size requires the index output mode" << endl;
+    return 1;
+  }
+
+  // the adders and comparisons: "chain" (the default) has the fewest AND
+  // gates, "brent-kung" and "sklansky" have logarithmic depth
+  CircuitShape shape = SHAPE_CHAIN;
+  if (argc > 7) {
+    if (string(argv[7]) == "brent-kung") {
+      shape = SHAPE_BRENT_KUNG;
+    } else if (string(argv[7]) == "sklansky") {
+      shape = SHAPE_SKLANSKY;
+    } else if (string(argv[7]) != "chain") {
+      cout << "unknown circuit shape " << argv[7] << endl;
+      return 1;
+    }
+  }
+
   byte* input = new byte[nElems * nBits];
   if (!ReadInputFile(input, inputFile, nElems * nBits)) {
     ServerLog("unable to read from input file");
@@ -63,7 +124,7 @@ int main(int argc, char** argv) {
 
   ServerLog("finished reading input");
 
-  ArgMaxArgs args(nElems, nBits);
+  ArgMaxArgs args(nElems, nBits, type, chunkSize, shape, streamed);
   StartServer(port, input, &args, RunProtocol);
 
   delete[] input;
@@ -16,9 +16,11 @@
  *
  */
 
+#include <chrono>
 #include <iostream>
 #include <sstream>
 #include <stdint.h>
+#include <vector>
 
 #include "OTExtension/protocol/OTClient.h"
 
@@ -26,38 +28,71 @@
 
 using namespace std;
 
-static void RunProtocol(CSocket* socket, byte* input, void* args) {
-  clock_t startTime = clock();
+// Prints the elements whose output is 1, of the count elements from first on.
+static void PrintElements(uint32_t first, uint32_t count, const int* outputVals) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (outputVals[i] == 1) {
+      cout << (first + i) << " ";
+    }
+  }
+}
+
+static void RunProtocol(Connection* connection, byte* input, void* args) {
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
 
   uint32_t nElems = ((BasicIntersectionArgs*) args)->nElems;
+  uint32_t chunkSize = ((BasicIntersectionArgs*) args)->chunkSize;
 
   uint32_t nClientInputWires = nElems;
   uint32_t nInputWires = 2 * nClientInputWires;
   uint32_t nOutputWires = nElems;
 
-  GarbledCircuit circuit;
-  CreateBasicIntersectionCircuit(circuit, nElems);
-
-  int* outputVals = new int[nOutputWires];
-  RunClientProtocol(socket, circuit, input, outputVals, nInputWires, nClientInputWires, nOutputWires);
-
-  double timeElapsed = (double)(clock() - startTime) / CLOCKS_PER_SEC;
-
-  cout << endl << "output: ";
-  for (int i = 0; i < nElems; i++) {
-    if (outputVals[i] == 1) {
-      cout << i << " ";
+  Circuit circuit;
+  long nAndGates = 0;
+  double timeElapsed;
+  if (chunkSize > 0) {
+    // the elements of each chunk are collected as soon as it is decoded,
+    // and printed once the protocol (and its timing) is done
+    vector<uint32_t> elements;
+    RunChunkedClientProtocol(connection, BasicIntersectionOp(), input, NULL, nElems, chunkSize, &nAndGates,
+                             [&](uint32_t first, uint32_t count, const int* outputVals) {
+      for (uint32_t i = 0; i < count; i++) {
+        if (outputVals[i] == 1) {
+          elements.push_back(first + i);
+        }
+      }
+    });
+    timeElapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    cout << endl << "output: ";
+    for (uint32_t element : elements) {
+      cout << element << " ";
     }
+    cout << endl << endl;
+  } else {
+    int* outputVals = new int[nOutputWires];
+    CreateBasicIntersectionCircuit(*circuit, nElems);
+    RunClientProtocol(connection, *circuit, input, outputVals, nInputWires, nClientInputWires, nOutputWires);
+    timeElapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    cout << endl << "output: ";
+    PrintElements(0, nElems, outputVals);
+    cout << endl << endl;
+
+    delete[] outputVals;
   }
-  cout << endl << endl;
 
   cout << "Number of elements:  " << nElems << endl;
-  PrintStatistics(socket, circuit, timeElapsed);
+  if (chunkSize > 0) {
+    PrintStatistics(connection, nAndGates, timeElapsed);
+  } else {
+    PrintStatistics(connection, *circuit, timeElapsed);
+  }
 }
 
 int main(int argc, const char** argv) {
   if (argc < 3) {
-    cout << "usage: ./BasicIntersectionClient input nElems [port]" << endl;
+    cout << "usage: ./BasicIntersectionClient input nElems [port [chunkSize]]" << endl;
     return 1;
   }
 
@@ -67,6 +102,10 @@ int main(int argc, const char** argv) {
   if (argc > 3) {
     port = atoi(argv[3]);
   }
+  uint32_t chunkSize = 0;
+  if (argc > 4) {
+    chunkSize = atoi(argv[4]);
+  }
 
   byte* input = new byte[nElems];
   if (!ReadInputFile(input, inputFile, nElems)) {
@@ -75,7 +114,7 @@ int main(int argc, const char** argv) {
   }
   ClientLog("finished reading input");
 
-  BasicIntersectionArgs args(nElems);
+  BasicIntersectionArgs args(nElems, chunkSize);
   StartClient("127.0.0.1", port, input, &args, RunProtocol);
 
   delete[] input;
@@ -26,23 +26,31 @@
 
 using namespace std;
 
-static void RunProtocol(CSocket* socket, byte* input, void* args) {
+static void RunProtocol(Connection* connection, byte* input, void* args) {
   uint32_t nElems = ((BasicIntersectionArgs*) args)->nElems;
+  uint32_t chunkSize = ((BasicIntersectionArgs*) args)->chunkSize;
+
+  if (chunkSize > 0) {
+    if (!RunChunkedServerProtocol(connection, BasicIntersectionOp(), input, nElems, chunkSize)) {
+      ServerLog("protocol execution failed");
+    }
+    return;
+  }
 
   uint32_t nServerInputWires = nElems;
   uint32_t nInputWires = 2 * nServerInputWires;
 
-  GarbledCircuit circuit;
-  CreateBasicIntersectionCircuit(circuit, nElems);
+  Circuit circuit;
+  CreateBasicIntersectionCircuit(*circuit, nElems);
 
-  if (!RunServerProtocol(socket, circuit, input, nInputWires, nServerInputWires)) {
+  if (!RunServerProtocol(connection, *circuit, input, nInputWires, nServerInputWires)) {
     ServerLog("protocol execution failed");
   }
 }
 
 int main(int argc, char** argv) {
   if (argc < 3) {
-    cout << "usage: ./BasicIntersectionServer input nElems [port]" << endl;
+    cout << "usage: ./BasicIntersectionServer input nElems [port [chunkSize]]" << endl;
     return 1;
   }
 
@@ -52,6 +60,10 @@ int main(int argc, char** argv) {
   if (argc > 3) {
     port = atoi(argv[3]);
   }
+  uint32_t chunkSize = 0;
+  if (argc > 4) {
+    chunkSize = atoi(argv[4]);
+  }
 
   byte* input = new byte[nElems];
   if (!ReadInputFile(input, inputFile, nElems)) {
@@ -61,7 +73,7 @@ int main(int argc, char** argv) {
 
   ServerLog("finished reading input");
 
-  BasicIntersectionArgs args(nElems);
+  BasicIntersectionArgs args(nElems, chunkSize);
   StartServer(port, input, &args, RunProtocol);
 
   delete[] input;
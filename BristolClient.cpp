@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2016, David J. Wu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+
+#include "OTExtension/protocol/OTClient.h"
+
+#include "common.h"
+
+using namespace std;
+
+static void RunProtocol(Connection* connection, byte* input, void* args) {
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+  GarbledCircuit* circuit = ((BristolArgs*) args)->circuit;
+  uint32_t nClientInputWires = ((BristolArgs*) args)->nClientInputWires;
+  const vector<int>& outputSizes = ((BristolArgs*) args)->outputSizes;
+
+  uint32_t nInputWires = circuit->n;
+  uint32_t nOutputWires = circuit->m;
+
+  int* outputVals = new int[nOutputWires];
+  RunClientProtocol(connection, *circuit, input, outputVals, nInputWires, nClientInputWires, nOutputWires);
+
+  double timeElapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+  // one bit-string per output value, in wire order
+  cout << endl << "output: ";
+  int wire = 0;
+  for (size_t i = 0; i < outputSizes.size(); i++) {
+    for (int j = 0; j < outputSizes[i]; j++) {
+      cout << outputVals[wire++];
+    }
+    cout << " ";
+  }
+  cout << endl << endl;
+
+  PrintStatistics(connection, *circuit, timeElapsed);
+
+  delete[] outputVals;
+}
+
+int main(int argc, const char** argv) {
+  if (argc < 3) {
+    cout << "usage: ./BristolClient circuit input [port]" << endl;
+    return 1;
+  }
+
+  const char* circuitFile = argv[1];
+  const char* inputFile = argv[2];
+  uint16_t port = 8100;
+  if (argc > 3) {
+    port = atoi(argv[3]);
+  }
+
+  Circuit circuit;
+  vector<int> inputSizes, outputSizes;
+  if (!readBristolCircuit(circuit.get(), circuitFile, &inputSizes, &outputSizes) || inputSizes.size() < 2) {
+    ClientLog("unable to read a two-party circuit from circuit file");
+    return 1;
+  }
+
+  uint32_t nClientInputWires = inputSizes[0];
+  byte* input = new byte[nClientInputWires];
+  if (!ReadInputFile(input, inputFile, nClientInputWires)) {
+    ClientLog("unable to read from input file");
+    return 1;
+  }
+  ClientLog("finished reading input");
+
+  BristolArgs args(circuit.get(), nClientInputWires, outputSizes);
+  StartClient("127.0.0.1", port, input, &args, RunProtocol);
+
+  delete[] input;
+
+  return 0;
+}
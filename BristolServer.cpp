@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2016, David J. Wu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+
+#include "OTExtension/protocol/OTServer.h"
+
+#include "common.h"
+
+using namespace std;
+
+static void RunProtocol(Connection* connection, byte* input, void* args) {
+  GarbledCircuit* circuit = ((BristolArgs*) args)->circuit;
+  uint32_t nClientInputWires = ((BristolArgs*) args)->nClientInputWires;
+
+  uint32_t nInputWires = circuit->n;
+  uint32_t nServerInputWires = nInputWires - nClientInputWires;
+
+  if (!RunServerProtocol(connection, *circuit, input, nInputWires, nServerInputWires)) {
+    ServerLog("protocol execution failed");
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    cout << "usage: ./BristolServer circuit input [port]" << endl;
+    return 1;
+  }
+
+  const char* circuitFile = argv[1];
+  const char* inputFile = argv[2];
+  uint16_t port = 8100;
+  if (argc > 3) {
+    port = atoi(argv[3]);
+  }
+
+  Circuit circuit;
+  vector<int> inputSizes, outputSizes;
+  if (!readBristolCircuit(circuit.get(), circuitFile, &inputSizes, &outputSizes) || inputSizes.size() < 2) {
+    ServerLog("unable to read a two-party circuit from circuit file");
+    return 1;
+  }
+
+  uint32_t nClientInputWires = inputSizes[0];
+  uint32_t nServerInputWires = circuit->n - nClientInputWires;
+  byte* input = new byte[nServerInputWires];
+  if (!ReadInputFile(input, inputFile, nServerInputWires)) {
+    ServerLog("unable to read from input file");
+    return 1;
+  }
+
+  ServerLog("finished reading input");
+
+  BristolArgs args(circuit.get(), nClientInputWires, outputSizes);
+  StartServer(port, input, &args, RunProtocol);
+
+  delete[] input;
+
+  return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2016, David J. Wu
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <iostream>
+#include <string>
+
+#include "common.h"
+
+using namespace std;
+
+// Writes one of the built-in circuits in Bristol Fashion. The first input
+// value is the client's input and the second is the server's, as in
+// BristolClient and BristolServer.
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    cout << "usage: ./ExportCircuit argmax|argmaxindex|setdiff nElems nBits output" << endl;
+    cout << "       ./ExportCircuit intersection nElems output" << endl;
+    return 1;
+  }
+
+  string op = argv[1];
+  int nElems = atoi(argv[2]);
+  Circuit circuit;
+  vector<int> outputSizes;
+  const char* outputFile;
+
+  if (op == "intersection") {
+    outputFile = argv[3];
+    CreateBasicIntersectionCircuit(*circuit, nElems);
+    outputSizes.push_back(nElems);
+  } else if ((op == "argmax" || op == "argmaxindex" || op == "setdiff") && argc > 4) {
+    int nBits = atoi(argv[3]);
+    outputFile = argv[4];
+    if (op == "argmax") {
+      CreateArgMaxCircuit(*circuit, nElems, nBits);
+      outputSizes.push_back(nElems);
+      outputSizes.push_back(nBits);
+    } else if (op == "argmaxindex") {
+      CreateArgMaxCircuit(*circuit, nElems, nBits, ARGMAX_INDEX);
+      outputSizes.push_back(ArgMaxIndexBits(nElems));
+      outputSizes.push_back(nBits);
+    } else {
+      CreateSetDiffCircuit(*circuit, nElems, nBits);
+      outputSizes.push_back(nElems);
+    }
+  } else {
+    cout << "unknown circuit " << op << endl;
+    return 1;
+  }
+
+  vector<int> inputSizes(2, circuit->n / 2);
+  if (!writeBristolCircuit(circuit.get(), outputFile, inputSizes, outputSizes)) {
+    return 1;
+  }
+
+  cout << "Number of gates:     " << getNumGates(circuit.get()) << endl;
+  cout << "Number of AND gates: " << circuit->nAndGates << endl;
+
+  return 0;
+}
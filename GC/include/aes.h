@@ -229,4 +229,21 @@ static inline void GC_AES_ecb_encrypt_blks_4(block *blks, GC_AES_KEY *key) {
     blks[3] = _mm_aesenclast_si128(blks[3], sched[j]);
 }
 
+// Encrypts up to 32 blocks in place. The count is rounded up to a power of two
+// so that every call unrolls over a compile-time number of blocks, which keeps
+// the blocks in registers and the AES pipeline full. blks must have room for
+// the rounded-up count.
+static inline void GC_AES_ecb_encrypt_blks_upto32(block *blks, unsigned nblks, GC_AES_KEY *key) {
+    if (nblks <= 2)
+        GC_AES_ecb_encrypt_blks(blks, 2, key);
+    else if (nblks <= 4)
+        GC_AES_ecb_encrypt_blks(blks, 4, key);
+    else if (nblks <= 8)
+        GC_AES_ecb_encrypt_blks(blks, 8, key);
+    else if (nblks <= 16)
+        GC_AES_ecb_encrypt_blks(blks, 16, key);
+    else
+        GC_AES_ecb_encrypt_blks(blks, 32, key);
+}
+
 #endif
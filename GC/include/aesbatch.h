@@ -0,0 +1,50 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AESBATCH_H_
+#define AESBATCH_H_
+
+#include "aes.h"
+
+// Largest number of blocks passed to GC_AES_ecb_encrypt_blks_batch. Buffers
+// handed to it must always have room for this many blocks, since the wide
+// implementations may encrypt (and overwrite) blocks past nblks.
+#define GC_AES_BATCH_BLOCKS 32
+
+typedef enum {
+  GC_AES_BACKEND_SSE,      // one block per AESENC (AES-NI)
+  GC_AES_BACKEND_VAES256,  // two blocks per AESENC (VAES + AVX2)
+  GC_AES_BACKEND_VAES512,  // four blocks per AESENC (VAES + AVX-512F)
+} GC_AES_BACKEND;
+
+// Encrypts nblks <= GC_AES_BATCH_BLOCKS blocks in place. The implementation
+// is chosen once, on the first call from any thread, from the instruction
+// sets reported by CPUID, so a single binary can run on machines with and
+// without VAES.
+void GC_AES_ecb_encrypt_blks_batch(block *blks, unsigned nblks, GC_AES_KEY *key);
+
+// Returns the backend used by GC_AES_ecb_encrypt_blks_batch.
+GC_AES_BACKEND GC_AES_get_backend();
+
+// Overrides the automatically selected backend. Returns false (and leaves the
+// current backend in place) if the CPU does not support the requested one.
+bool GC_AES_set_backend(GC_AES_BACKEND backend);
+
+#endif /* AESBATCH_H_ */
@@ -0,0 +1,90 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <vector>
+
+// Default size of the chunks an Arena takes from the heap.
+#define ARENA_CHUNK_SIZE (1 << 20)
+
+// A bump allocator. Memory is handed out from large chunks and given back
+// all at once, by releasing the arena to an earlier mark, so that building
+// a circuit does not go to the heap for every temporary wire array. The
+// chunks are kept when memory is released and are reused by later
+// allocations; they are only freed by the destructor.
+class Arena {
+ public:
+  struct Mark {
+    size_t chunk, offset;
+  };
+
+  explicit Arena(size_t chunkSize = ARENA_CHUNK_SIZE);
+  ~Arena();
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Returns uninitialized space for count objects of type T, which must be
+  // trivially constructible and destructible.
+  template <typename T>
+  T *allocate(size_t count) {
+    return (T*) allocateBytes(sizeof(T) * count, alignof(T));
+  }
+
+  Mark mark() const;
+  // Releases everything allocated after mark was taken.
+  void release(Mark mark);
+
+ private:
+  void *allocateBytes(size_t size, size_t alignment);
+
+  size_t chunkSize;
+  std::vector<std::pair<char*, size_t>> chunks;
+  size_t current, offset;
+};
+
+// Allocates from an arena and releases everything it allocated when it
+// goes out of scope.
+class ArenaScope {
+ public:
+  explicit ArenaScope(Arena *arena) : arena(arena), start(arena->mark()) { }
+  ~ArenaScope() { arena->release(start); }
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+  template <typename T>
+  T *allocate(size_t count) {
+    return arena->allocate<T>(count);
+  }
+
+ private:
+  Arena *arena;
+  Arena::Mark start;
+};
+
+// The arena that circuit builders on the calling thread take their scratch
+// space from (see startBuilding). It lives as long as the thread.
+Arena *getBuildArena();
+
+#endif /* ARENA_H_ */
@@ -23,15 +23,38 @@
 
 #include "justGarble.h"
 
-void ADDCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int* inputs, int* outputs);
-void EQCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs);
+// The shape of the carry and comparison networks of the k-bit arithmetic
+// circuits below, which trades AND gates for AND depth (as counted on the
+// built circuits for k = 8 to 64):
+//  * SHAPE_CHAIN: ripple chains, with the fewest AND gates and depth about
+//    k. An adder has k - 1 AND gates, a comparison k and an equality test
+//    k - 1.
+//  * SHAPE_BRENT_KUNG: a Brent-Kung prefix adder, with about 3.6k AND gates
+//    (229 for k = 64) and depth 2 log k - 1. Each combine of two carry
+//    ranges costs 2 AND gates, less those whose propagate bit is never read.
+//    Comparisons are balanced trees of the same combines, with about 3k AND
+//    gates (184 for k = 64) and depth log k + 1, and equality tests are OR
+//    trees, with k - 1 AND gates and depth log k.
+//  * SHAPE_SKLANSKY: a Sklansky prefix adder, with about k log k AND gates
+//    (373 for k = 64) and depth log k + 1. Comparisons and equality tests
+//    are as for SHAPE_BRENT_KUNG.
+enum CircuitShape { SHAPE_CHAIN, SHAPE_BRENT_KUNG, SHAPE_SKLANSKY };
+
+void ADDCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int* inputs, int* outputs, CircuitShape shape = SHAPE_CHAIN);
+void EQCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void ORReduceCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
 void ANDCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs);
-void CMPCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs);
+void CMPCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
 void MUXCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs);
-void MAXCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs);
-void MAXVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs);
-void ARGMAXVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs);
-void ARGMAXVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs);
-void SetDiffVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs);
+void MAXCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void MAXVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void MAXVecTreeCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void ARGMAXVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void ARGMAXVecTreeCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void ARGMAXIndexVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void ARGMAXVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void ARGMAXVecSharedTreeCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void ARGMAXIndexVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
+void SetDiffVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape = SHAPE_CHAIN);
 
 #endif
@@ -46,6 +46,15 @@ static inline int getLSB(block x) {
   return val & 1;
 }
 
+// Returns an all-ones block if getLSB(x) is 1 and an all-zeros block
+// otherwise, so that the point-and-permute bit can select a block without
+// a branch.
+static inline block getLSBMask(block x) {
+  block lsb = _mm_and_si128(x, _mm_set_epi64x(0, 1));
+  block mask = _mm_sub_epi64(_mm_setzero_si128(), lsb);
+  return _mm_shuffle_epi32(mask, _MM_SHUFFLE(1, 0, 1, 0));
+}
+
 #define makeBlock(X,Y) _mm_set_epi64((__m64)(X), (__m64)(Y))
 #define getFromBlock(X,i) _mm_extract_epi64(X, i)
 
@@ -120,6 +129,7 @@ static inline block RIGHTSHIFT(block bl) {
 #define TIMES 10
 #define RUNNING_TIME_ITER 100
 
+void seedRandom();
 block randomBlock();
 
 #endif
@@ -25,6 +25,7 @@
 #include "common.h"
 #include "justGarble.h"
 #include "dkcipher.h"
+#include "aesbatch.h"
 
 #define FIXED_ZERO_GATE 1
 #define FIXED_ONE_GATE 15
@@ -37,7 +38,87 @@
 #define XOR_ID -2
 #define NOT_ID -3
 
+// Number of independent AND gates whose hashes are computed together by the
+// garbler and the evaluator, respectively.
+#define GARBLE_BATCH_SIZE 8
+#define EVAL_BATCH_SIZE 16
+
+// Each garbled AND gate hashes four blocks and each evaluated one hashes two.
+#if 4 * GARBLE_BATCH_SIZE > GC_AES_BATCH_BLOCKS || 2 * EVAL_BATCH_SIZE > GC_AES_BATCH_BLOCKS
+#error "AND gate batches must fit in GC_AES_BATCH_BLOCKS hash blocks"
+#endif
+
+// Number of consecutive gates that scheduleCircuit may reorder at a time.
+// Larger windows give longer runs, which can be split across more threads,
+// at the cost of locality.
+#define SCHEDULE_WINDOW 65536
+
+// Runs are split into chunks of this many gates for the thread pool. Runs
+// of less than two chunks are processed on the calling thread.
+#define AND_CHUNK_SIZE 256
+#define XOR_CHUNK_SIZE 8192
+
+// Instances of a replicated stage are split into chunks of this many
+// instances for the thread pool.
+#define INSTANCE_CHUNK_SIZE 1024
+
+// When garbleCircuit hands tables to a sink, or evaluate reads them from a
+// source, the replicated stage is processed this many instances at a time,
+// with a buffer for the tables of one wave, and the tables of the rest of
+// the circuit pass through a window of TABLE_WINDOW_SIZE tables.
+#define TABLE_INSTANCE_WAVE 16384
+#define TABLE_WINDOW_SIZE 16384
+
+// buildElements splits the elements into chunks of this many elements for
+// the thread pool.
+#define BUILD_CHUNK_SIZE 1024
+
 int getNextWire(GarblingContext *garblingContext);
+block *getWireLabels(GarbledCircuit *garbledCircuit, block **labels);
+GarbledTable *getGarbledTable(GarbledCircuit *garbledCircuit);
 void removeGarbledCircuit(GarbledCircuit *garbledCircuit);
 
+// Owns a GarbledCircuit and removes it when it goes out of scope, so that
+// a circuit is released exactly once however the code that uses it exits.
+// It can be moved but not copied. Circuits that are not owned this way
+// must be removed with removeGarbledCircuit.
+class Circuit {
+ public:
+  Circuit() : circuit() { }
+  ~Circuit() { removeGarbledCircuit(&circuit); }
+
+  Circuit(Circuit &&other) : circuit(std::move(other.circuit)) {
+    other.circuit = GarbledCircuit();
+  }
+  Circuit &operator=(Circuit &&other) {
+    if (this != &other) {
+      removeGarbledCircuit(&circuit);
+      circuit = std::move(other.circuit);
+      other.circuit = GarbledCircuit();
+    }
+    return *this;
+  }
+  Circuit(const Circuit &) = delete;
+  Circuit &operator=(const Circuit &) = delete;
+
+  GarbledCircuit *get() { return &circuit; }
+  GarbledCircuit &operator*() { return circuit; }
+  GarbledCircuit *operator->() { return &circuit; }
+
+ private:
+  GarbledCircuit circuit;
+};
+
+// Garble or evaluate the replicated stage of a circuit, writing the labels
+// of its outputs to the input wires of the rest of the circuit. The tables
+// are in garbledTable, unless sink or tableSource is set: the stage is then
+// processed in waves of TABLE_INSTANCE_WAVE instances, and the tables of
+// each wave are handed to sink after it or read from tableSource before it.
+void garbleReplicatedStage(GarbledCircuit *garbledCircuit, InputLabelSource *source,
+                           DKCipherContext *dkCipherContext, DKCipherContext *fixedWireCipherContext,
+                           const TableSink &sink = TableSink());
+void evaluateReplicatedStage(GarbledCircuit *garbledCircuit, ExtractedLabels extractedLabels,
+                             DKCipherContext *dkCipherContext, DKCipherContext *fixedWireCipherContext,
+                             const TableSource &tableSource = TableSource());
+
 #endif
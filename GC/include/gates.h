@@ -29,4 +29,9 @@ int XORGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, in
 int fixedZeroWire(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext);
 int fixedOneWire(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext);
 
+// Makes room for nGates more gates after the current one, doubling the gate
+// array if it is full. The array is never zeroed, so its unused tail is
+// never touched.
+void reserveGates(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, long nGates);
+
 #endif /* GATES_H_ */
@@ -22,6 +22,10 @@
 #ifndef __JUST_GARBLE_H__
 #define __JUST_GARBLE_H__
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <vector>
 #include <unordered_map>
 
@@ -30,41 +34,82 @@
 
 using namespace std;
 
+// Gates refer to wires (label slots once assignWireSlots has run) by 32-bit
+// index, so that a gate fits in 16 bytes.
 typedef struct {
-  long value, id;
-  block label, label0, label1;
-} Wire;
-
-typedef struct {
-  long type, id; 
-  Wire *input0, *input1, *output;
-} Gate;
-
-typedef struct {
-  long input0, input1, output; int id, type;
+  uint32_t input0, input1, output; int type;
 } GarbledGate;
 
 typedef struct {
   block table[2];
 } GarbledTable;
 
+// A run of count consecutive gates, starting at start, that all have the
+// given type. See scheduleCircuit.
+typedef struct {
+  int type, start, count;
+} GateRun;
+
+struct ReplicatedStage;
+
 typedef struct {
   int n, m, q, r;
   long id;
   block globalKey;
 
-  Wire* wires;
+  // Wire labels are kept in dense arrays indexed by wire. The garbler only
+  // stores the 0-label of every wire, since the 1-label is label0 ^ R, and
+  // the evaluator only stores the active label. Each array is allocated
+  // the first time garbleCircuit or evaluate needs it.
+  block *wireLabels0;
+  block R;
+  block *wireLabels;
+
   GarbledGate *garbledGates;
   int *outputs;
+  // inputWires[i] is the wire that carries the i-th input label, which is
+  // i unless the wires have been renumbered.
+  int *inputWires;
 
+  // One table per AND gate, in schedule order. XOR gates are free and have
+  // no table. Allocated by getGarbledTable, the first time it is needed.
   GarbledTable *garbledTable;
   block *fixedLabels;
   int nAndGates;
 
   vector<pair<int, int>> fixedWireIndices;
   block fixedWiresSeed;
+
+  vector<GateRun> runs;
+
+  // Optional element-wise first stage, see addReplicatedStage.
+  struct ReplicatedStage *stage;
+
+  // Set if garbledGates, outputs and inputWires point into a circuit file
+  // mapped by loadCircuit, in which case they are not freed. Only the
+  // circuit that owns the mapping has mapping set.
+  bool mapped;
+  void *mapping;
+  size_t mappingSize;
 } GarbledCircuit;
 
+// A subcircuit applied to each of nInstances elements, described by a
+// single instance. Input j of instance e is circuit input
+// inputOffsets[j] + e * inputStrides[j], and output j of instance e becomes
+// input outputOffsets[j] + e * outputStrides[j] of the gates of the circuit
+// that owns the stage. The instance counts its own gates, tables and fixed
+// wires; the owning circuit's n and nAndGates include those of every
+// instance.
+typedef struct ReplicatedStage {
+  GarbledCircuit instance;
+  int nInstances;
+  // n of the owning circuit before the stage was added (the length of its
+  // inputWires)
+  int nBodyInputs;
+  int *inputOffsets, *inputStrides;
+  int *outputOffsets, *outputStrides;
+} ReplicatedStage;
+
 typedef struct {
   int m;
   block *outputLabels;
@@ -73,6 +118,17 @@ typedef struct {
 
 typedef struct {
   long wireIndex, gateIndex, tableIndex;
+  // Between startDryRun and finishDryRun, gates and fixed wires are only
+  // counted, not stored.
+  bool dryRun;
+  // the number of fixed wires added so far
+  long nFixedWires;
+  // Scratch space for the builders, released by each builder before it
+  // returns.
+  class Arena *arena;
+  // If set (see startStreaming), gates and fixed wires go to the stream
+  // instead of the circuit.
+  class GateStream *stream;
 } GarblingContext;
 
 
@@ -80,6 +136,43 @@ typedef block* InputLabels;
 typedef block* ExtractedLabels;
 typedef block* OutputMap;
 
+// Receives the tables of a circuit in order, a batch at a time.
+typedef function<void(const GarbledTable *tables, int count)> TableSink;
+// Fills tables with the next count tables of a circuit.
+typedef function<void(GarbledTable *tables, int count)> TableSource;
+
+// Tracks how many of the stored labels of an InputLabelSource have been
+// written, so that garbling can start while the rest are still being
+// produced (e.g. by later batches of OT). One thread publishes, and
+// getInputLabels waits until every stored label it reads is published.
+class InputLabelProgress {
+ public:
+  InputLabelProgress() : nReady(0) { }
+
+  // Marks the first nReady stored labels as written.
+  void publish(long nReady);
+  // Returns once the first nReady stored labels have been written.
+  void waitFor(long nReady);
+
+ private:
+  atomic<long> nReady;
+  mutex lock;
+  condition_variable published;
+};
+
+// The garbler's input labels, derived on demand rather than stored as 2n
+// blocks. The 0-label of input i is storedLabels[i * stride] for the first
+// nStored inputs (e.g. labels that come out of OT), and AES(seed, i) for
+// every other input. Every 1-label is the 0-label XOR R. If progress is
+// set, the stored labels may still be being written.
+typedef struct {
+  block R;
+  block *storedLabels;
+  int nStored, stride;
+  DKCipherContext seedCipherContext;
+  InputLabelProgress *progress;
+} InputLabelSource;
+
 
 /*
  * The following are the functions involved in creating, garbling, and 
@@ -99,7 +192,105 @@ typedef block* OutputMap;
 void startBuilding(GarbledCircuit *gc, GarblingContext *garblingContext);
 void finishBuilding(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int *outputs);
 
-// Create memory for an empty circuit of the specified size.
+// Running a builder between startDryRun and finishDryRun only counts the
+// gates, wires and fixed wires it adds. finishDryRun then sets q and r of
+// the circuit to the exact counts and allocates exactly that much, so that
+// the builder can be run again between startBuilding and finishBuilding
+// without the gate array ever growing.
+void startDryRun(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext);
+void finishDryRun(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext);
+
+// Adds a subcircuit for each of nElems elements, where buildElement(
+// garbledCircuit, garblingContext, e) adds the one for element e. Every
+// element must add the same number of gates, wires and fixed wires and
+// must not depend on the wires of other elements. The elements are split
+// into ranges that are built on the garbling thread pool, each starting
+// from precomputed wire, gate and fixed-wire offsets, so that the circuit
+// is identical to one built element by element. Into a stream (see
+// stream.h) the elements are built one by one on the calling thread.
+void buildElements(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int nElems,
+                   const std::function<void(GarbledCircuit*, GarblingContext*, int)> &buildElement);
+
+// Simplifies a built circuit: propagates constants (fixed wires), pushes
+// negations through XOR gates, rewrites OR gates as AND gates with negated
+// inputs and output, merges gates that compute the same function of the same
+// wires, and drops gates that no output depends on. Negations that cannot be
+// pushed any further become NOT gates, which are free: they flip the label
+// without any table. Only the fixed wires that carry constant outputs remain.
+// finishBuilding calls this first.
+void optimizeCircuit(GarbledCircuit *garbledCircuit);
+
+// Reorders the gates of a built circuit by level, so that they form runs of
+// XOR, NOT and AND gates that never depend on other gates of the same run,
+// and records the runs. garbleCircuit and evaluate process one run at a
+// time, hashing AND gates in batches and splitting large runs across
+// threads. Gates are only moved within windows of the given size, which
+// keeps neighbouring gates close together. finishBuilding calls this with
+// SCHEDULE_WINDOW; any pass that rewrites the gates afterwards must call it
+// again.
+void scheduleCircuit(GarbledCircuit *garbledCircuit, int window);
+
+// Renumbers the wires of a scheduled circuit in the order in which gates
+// first use them, so that wires read by neighbouring gates (including the
+// input wires) have neighbouring label slots, and drops unused wires. The
+// inputs and outputs keep their order through inputWires and outputs.
+// finishBuilding calls this after scheduleCircuit.
+void renumberWires(GarbledCircuit *garbledCircuit);
+
+// Maps the wires of a scheduled circuit onto a pool of reusable label slots.
+// Input and fixed wires, which are all live before the first gate, get slots
+// of their own where the first gate reads them, so that they stay next to
+// the wires of that gate as renumberWires placed them. Output wires keep their slots to the end, while every other
+// slot (including those of input and fixed wires) is recycled after the run
+// in which its wire is read for the last time, so that the gates of a run
+// can be processed in any order. Gates,
+// inputWires, fixedWireIndices and outputs then refer to slots, and r
+// becomes the number of slots, which grows with the width of the circuit
+// rather than with its number of wires. finishBuilding calls this last.
+void assignWireSlots(GarbledCircuit *garbledCircuit);
+
+// Puts a replicated stage in front of a finished circuit, whose inputs then
+// become the outputs of the stage and whose n becomes nInputs. instance must
+// be a finished circuit, which the stage takes over (it must not be removed
+// separately), and the offset and stride arrays are copied. garbleCircuit
+// and evaluate process the stage a few instances at a time from a single
+// copy of its topology, so that gates are never expanded per element.
+void addReplicatedStage(GarbledCircuit *garbledCircuit, GarbledCircuit *instance, int nInstances, int nInputs,
+                        int *inputOffsets, int *inputStrides, int *outputOffsets, int *outputStrides);
+
+// Returns the number of gates of a circuit, including every instance of
+// its replicated stage.
+long getNumGates(GarbledCircuit *garbledCircuit);
+
+// Writes a finished circuit (including its replicated stage) to filename,
+// tagged with key, and returns false if the file cannot be written. The file
+// is written under a temporary name and renamed, so that a concurrent
+// loadCircuit never sees a partial file.
+bool saveCircuit(GarbledCircuit *garbledCircuit, const char *filename, const char *key);
+
+// Loads a circuit written by saveCircuit with the same key. The gates are
+// mapped from the file rather than read, so loading takes time proportional
+// to the number of runs and fixed wires only. Returns false, leaving
+// garbledCircuit untouched, if the file is missing, was written by another
+// version of this format or for another key, or is truncated.
+bool loadCircuit(GarbledCircuit *garbledCircuit, const char *filename, const char *key);
+
+// Builds a circuit from a file in Bristol Fashion, and returns the number of
+// bits of each of its input and output values, whose bits are the inputs and
+// outputs of the circuit in order. Returns false, leaving garbledCircuit
+// untouched, if the file cannot be read or uses unsupported gates.
+bool readBristolCircuit(GarbledCircuit *garbledCircuit, const char *filename,
+                        vector<int> *inputSizes, vector<int> *outputSizes);
+
+// Writes a finished circuit in Bristol Fashion, splitting its inputs and
+// outputs into values of the given sizes. Replicated stages are written out
+// instance by instance, and fixed wires become EQ gates.
+bool writeBristolCircuit(GarbledCircuit *garbledCircuit, const char *filename,
+                         const vector<int> &inputSizes, const vector<int> &outputSizes);
+
+// Create memory for an empty circuit of the specified size. q is only the
+// initial capacity for gates (it may be 0): the gate array grows as gates
+// are added. None of the memory is zeroed.
 void createEmptyGarbledCircuit(GarbledCircuit *garbledCircuit, int n, int m, int q, int r);
 
 //Garble the circuit described in garbledCircuit. For efficiency reasons,
@@ -120,19 +311,57 @@ void createInputLabels(InputLabels inputLabels, int n, block R);
 void garbleCircuit(GarbledCircuit *garbledCircuit, InputLabels inputLabels,
     OutputMap outputMap);
 
+// Sets up an InputLabelSource over the nStored 0-labels in storedLabels and
+// a fresh random seed for the remaining inputs. The stored labels must differ
+// from their 1-labels by R, and are not copied. Its progress is not set.
+void createInputLabelSource(InputLabelSource *source, block *storedLabels, int nStored, block R);
+
+// Writes the 0-labels of the count inputs listed in inputs to labels.
+void getInputLabels(InputLabelSource *source, const long *inputs, int count, block *labels);
+
+// Garbles the circuit as above, reading each input label from source when
+// it is needed.
+void garbleCircuit(GarbledCircuit *garbledCircuit, InputLabelSource *source,
+    OutputMap outputMap);
+
+// Garbles the circuit as above, but hands its tables to sink, in order, as
+// they are produced instead of writing them to garbledTable: after each
+// wave of TABLE_INSTANCE_WAVE instances of the replicated stage, then
+// whenever TABLE_WINDOW_SIZE more tables are done, and at the end. Only
+// buffers of that size are used, so garbledTable is never allocated. The
+// tables passed to sink are only valid during the call. sink is called on
+// the garbling thread, so sending the tables from it overlaps the network
+// with the rest of the garbling. The keys of the circuit (globalKey and
+// fixedWiresSeed) are set before sink is first called.
+void garbleCircuit(GarbledCircuit *garbledCircuit, InputLabelSource *source,
+    OutputMap outputMap, const TableSink &sink);
+
 //Evaluate a garbled circuit, using n input labels in the Extracted Labels
 //to return m output labels. The garbled circuit might be generated either in 
 //one piece, as the result of running garbleCircuit, or may be pieced together,
 // by building the circuit (startBuilding ... finishBuilding), and adding 
-// garbledTable from another source, say, a network transmission.
+// garbledTable (see getGarbledTable) from another source, say, a network
+// transmission.
 void evaluate(GarbledCircuit *garbledCircuit, ExtractedLabels extractedLabels,
     OutputMap outputMap);
 
+// Evaluates the circuit as above, but reads its tables from source, in
+// order, as they are needed instead of from garbledTable, in pieces of at
+// most TABLE_WINDOW_SIZE tables (or a wave of the replicated stage). A
+// source that reads from the network thus overlaps the download with the
+// evaluation, and garbledTable is never allocated.
+void evaluate(GarbledCircuit *garbledCircuit, ExtractedLabels extractedLabels,
+    OutputMap outputMap, const TableSource &source);
+
 // A simple function that selects n input labels from 2n labels, using the 
 // inputBits array where each element is a bit.
 void extractLabels(ExtractedLabels extractedLabels, InputLabels inputLabels,
     uint8_t* inputBits, int n);
 
+// As above, for the n inputs starting at input begin of an InputLabelSource.
+void extractLabels(ExtractedLabels extractedLabels, InputLabelSource *source,
+    uint8_t* inputBits, long begin, int n);
+
 // A simple function that takes 2m output labels, m labels from evaluate, 
 // and returns a m bit output by matching the labels. If one or more of the
 // m evaluated labels donot match either of the two corresponding output labels,
@@ -142,5 +371,6 @@ void mapOutputs(OutputMap outputMap, OutputMap extractedMap, int *outputVals,
 
 #include "garble.h"
 #include "util.h"
+#include "threadpool.h"
 
 #endif
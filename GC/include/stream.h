@@ -0,0 +1,201 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include "justGarble.h"
+#include "dkcipher.h"
+
+#include <functional>
+#include <vector>
+
+// Number of gates a GateStream buffers before garbling or evaluating them.
+#define STREAM_BUFFER_SIZE 4096
+
+// Number of labels in each page of the label store of a GateStream.
+#define LABEL_PAGE_BITS 12
+#define LABEL_PAGE_SIZE (1 << LABEL_PAGE_BITS)
+
+// Garbles or evaluates a circuit while it is being built, so that neither
+// its gates nor its tables are ever stored in full. Between startStreaming
+// and finish, gates go into a buffer of STREAM_BUFFER_SIZE gates, which is
+// garbled (or evaluated) in order whenever it fills up. Gate ids, tables
+// and fixed labels follow the order in which gates are added, so the
+// garbler and the evaluator must run the same builder, with the same calls
+// to pin, keepOnly and output.
+//
+// Labels are kept in pages indexed by wire, allocated when a wire in them
+// is first written (or, for an input, first read, and read again from the
+// side's input labels after the page is dropped). Builders do not say when
+// a wire is read for the last time, so a builder that works through its
+// input in steps says which labels it still needs: pin keeps the labels of
+// some wires to the end, keepOnly drops every other label, and output hands
+// over the labels of output wires, which may then be dropped as well. Only
+// the pinned labels and the labels read or written since the last keepOnly
+// are then resident.
+class GateStream {
+ public:
+  virtual ~GateStream();
+  GateStream(const GateStream &) = delete;
+  GateStream &operator=(const GateStream &) = delete;
+
+  void addGate(int type, int input0, int input1, int output);
+  void addFixedWire(int wire, int type);
+
+  // Garbles or evaluates every buffered gate.
+  void flush();
+
+  // Flushes, then keeps the labels of the count given wires until the end
+  // of the stream, in a store of their own that keepOnly does not drop.
+  // They must come after every wire pinned before.
+  void pin(const int *wires, int count);
+
+  // Flushes, then drops the labels of every wire that is neither pinned nor
+  // one of the count given wires. The labels of inputs are read again when
+  // they are needed.
+  void keepOnly(const int *wires, int count);
+
+  // Flushes, then hands over the labels of the count given wires as the
+  // next count outputs of the circuit.
+  void output(const int *wires, int count);
+
+  // Flushes, and checks that every output has been handed over.
+  void finish();
+
+  long getNumGates() const { return nGates + nBuffered; }
+  long getNumAndGates() const { return nTables; }
+  // the number of label pages currently allocated
+  long getNumLabelPages() const;
+
+  // The keys of the circuit, which the garbler chooses at random and the
+  // evaluator is given.
+  block getGlobalKey() const { return globalKey; }
+  block getFixedWiresSeed() const { return fixedWiresSeed; }
+
+ protected:
+  GateStream(int nInputs, int nOutputs, int batchSize, block globalKey, block fixedWiresSeed);
+
+  // The label of a wire that has been written and not dropped, or of an
+  // input.
+  block &label(int wire);
+  // Makes room for the label of a wire that is about to be written.
+  block &newLabel(int wire);
+
+  // A buffered AND (or OR) gate, with its id and the position of its table
+  // among the tables of the buffer.
+  struct PendingGate {
+    const GarbledGate *gate;
+    long id;
+    int table;
+  };
+
+  // Hooks for the two sides. Within a flush, the tables of the buffered AND
+  // and OR gates are in gate order; readTables is called before any of
+  // them is processed and writeTables after all of them are.
+  virtual void loadInputs(int first, int count, block *labels) = 0;
+  virtual void processFreeGate(const GarbledGate *gate) = 0;
+  virtual void processANDBatch(const PendingGate *batch, int count) = 0;
+  virtual void setFixedLabel(int wire, int type, block label) = 0;
+  virtual void setOutput(int i, block label) = 0;
+  virtual void readTables(int count) { }
+  virtual void writeTables(int count) { }
+
+  int nInputs, nOutputs;
+  block globalKey, fixedWiresSeed;
+  DKCipherContext dkCipherContext, fixedWireCipherContext;
+  // tables of the current flush
+  GarbledTable *tables;
+  long nTables;
+
+ private:
+  struct LabelPage {
+    block labels[LABEL_PAGE_SIZE];
+  };
+  LabelPage *page(size_t p);
+
+  size_t findPinned(int wire);
+
+  vector<LabelPage*> pages;
+  // pages dropped by keepOnly, for reuse
+  vector<LabelPage*> freePages;
+  // the pinned wires in order, and their labels in pages of their own
+  vector<int> pinnedWires;
+  vector<LabelPage*> pinnedPages;
+  GarbledGate *buffer;
+  int nBuffered, batchSize, nOutputsDone;
+  long nGates, nFixedWires;
+  // where the last pinned wire was found
+  size_t lastPinned;
+};
+
+// The garbler's side of a streamed circuit. The input labels come from
+// source (whose stored labels may still be being written, see
+// InputLabelProgress), the tables of each flushed batch of gates go to
+// sink, and the output map of the nOutputs outputs to outputMap.
+class GarblingStream : public GateStream {
+ public:
+  GarblingStream(int nInputs, int nOutputs, InputLabelSource *source, OutputMap outputMap, TableSink sink);
+
+ protected:
+  void loadInputs(int first, int count, block *labels);
+  void processFreeGate(const GarbledGate *gate);
+  void processANDBatch(const PendingGate *batch, int count);
+  void setFixedLabel(int wire, int type, block label);
+  void setOutput(int i, block label);
+  void writeTables(int count);
+
+ private:
+  InputLabelSource *source;
+  block R;
+  OutputMap outputMap;
+  TableSink sink;
+};
+
+// The evaluator's side of a streamed circuit, given the n extracted input
+// labels and the keys of the garbler. The tables of each flushed batch of
+// gates are read from source, and the labels of the nOutputs outputs go to
+// outputLabels.
+class EvaluatingStream : public GateStream {
+ public:
+  EvaluatingStream(int nInputs, int nOutputs, ExtractedLabels extractedLabels, block globalKey,
+                   block fixedWiresSeed, TableSource source, block *outputLabels);
+
+ protected:
+  void loadInputs(int first, int count, block *labels);
+  void processFreeGate(const GarbledGate *gate);
+  void processANDBatch(const PendingGate *batch, int count);
+  void setFixedLabel(int wire, int type, block label);
+  void setOutput(int i, block label);
+  void readTables(int count);
+
+ private:
+  ExtractedLabels extractedLabels;
+  TableSource source;
+  block *outputLabels;
+};
+
+// Starts building garbledCircuit, whose n must be set, into stream rather
+// than into its gate array. Builders are then run as usual, and hand their
+// outputs to stream->output; finishBuilding is not called.
+void startStreaming(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, GateStream *stream);
+
+#endif /* STREAM_H_ */
@@ -0,0 +1,42 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <functional>
+
+// Splits [0, count) into chunks of chunkSize and calls fn(begin, end) on
+// every chunk, using all threads of the garbling pool including the calling
+// one. Each thread starts on a contiguous share of the chunks and steals
+// from the end of the other shares once its own runs out. Returns after
+// every chunk has finished. Any thread may call parallelFor, but the pool
+// runs one call at a time: a call made while it is busy (from another
+// thread, or from fn itself) runs all of its chunks on the calling thread.
+void parallelFor(int count, int chunkSize, const std::function<void(int, int)> &fn);
+
+// Sets the number of threads used by parallelFor, including the calling
+// thread. The default is the number of hardware threads. Must not be called
+// while any thread is inside parallelFor.
+void setNumThreads(int nThreads);
+int getNumThreads();
+
+#endif /* THREADPOOL_H_ */
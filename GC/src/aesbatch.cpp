@@ -0,0 +1,165 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "include/aesbatch.h"
+
+#include <immintrin.h>
+
+#include <atomic>
+#include <mutex>
+
+static void ecbEncryptSSE(block *blks, unsigned nblks, GC_AES_KEY *key) {
+  GC_AES_ecb_encrypt_blks_upto32(blks, nblks, key);
+}
+
+// Same as _mm512_broadcast_i32x4, whose definition in GCC's headers trips
+// -Wuninitialized. The zero-masked form with a full mask is the same
+// instruction.
+__attribute__((target("avx512f")))
+static inline __m512i broadcast512(block b) {
+  return _mm512_maskz_broadcast_i32x4((__mmask16) 0xffff, b);
+}
+
+// Each of the NV vectors holds four consecutive blocks.
+template <int NV>
+__attribute__((target("vaes,avx512f")))
+static inline void encryptVAES512(block *blks, const GC_AES_KEY *key) {
+  int rnds = GC_ROUNDS(key);
+  const __m512i k0 = broadcast512(key->rd_key[0]);
+  __m512i x[NV];
+  for (int i = 0; i < NV; i++)
+    x[i] = _mm512_xor_si512(_mm512_loadu_si512((__m512i *) (blks + 4*i)), k0);
+  for (int j = 1; j < rnds; j++) {
+    const __m512i kj = broadcast512(key->rd_key[j]);
+    for (int i = 0; i < NV; i++)
+      x[i] = _mm512_aesenc_epi128(x[i], kj);
+  }
+  const __m512i kn = broadcast512(key->rd_key[rnds]);
+  for (int i = 0; i < NV; i++)
+    _mm512_storeu_si512((__m512i *) (blks + 4*i), _mm512_aesenclast_epi128(x[i], kn));
+}
+
+__attribute__((target("vaes,avx512f")))
+static void ecbEncryptVAES512(block *blks, unsigned nblks, GC_AES_KEY *key) {
+  if (nblks <= 4)
+    encryptVAES512<1>(blks, key);
+  else if (nblks <= 8)
+    encryptVAES512<2>(blks, key);
+  else if (nblks <= 16)
+    encryptVAES512<4>(blks, key);
+  else
+    encryptVAES512<8>(blks, key);
+}
+
+// Each of the NV vectors holds two consecutive blocks.
+template <int NV>
+__attribute__((target("vaes,avx2")))
+static inline void encryptVAES256(block *blks, const GC_AES_KEY *key) {
+  int rnds = GC_ROUNDS(key);
+  const __m256i k0 = _mm256_broadcastsi128_si256(key->rd_key[0]);
+  __m256i x[NV];
+  for (int i = 0; i < NV; i++)
+    x[i] = _mm256_xor_si256(_mm256_loadu_si256((__m256i *) (blks + 2*i)), k0);
+  for (int j = 1; j < rnds; j++) {
+    const __m256i kj = _mm256_broadcastsi128_si256(key->rd_key[j]);
+    for (int i = 0; i < NV; i++)
+      x[i] = _mm256_aesenc_epi128(x[i], kj);
+  }
+  const __m256i kn = _mm256_broadcastsi128_si256(key->rd_key[rnds]);
+  for (int i = 0; i < NV; i++)
+    _mm256_storeu_si256((__m256i *) (blks + 2*i), _mm256_aesenclast_epi128(x[i], kn));
+}
+
+__attribute__((target("vaes,avx2")))
+static void ecbEncryptVAES256(block *blks, unsigned nblks, GC_AES_KEY *key) {
+  if (nblks <= 2)
+    encryptVAES256<1>(blks, key);
+  else if (nblks <= 4)
+    encryptVAES256<2>(blks, key);
+  else if (nblks <= 8)
+    encryptVAES256<4>(blks, key);
+  else if (nblks <= 16)
+    encryptVAES256<8>(blks, key);
+  else
+    encryptVAES256<16>(blks, key);
+}
+
+// The selected backend, or -1 until the first call (or GC_AES_set_backend)
+// selects one. Indexes backendFunctions.
+static std::atomic<int> currentBackend(-1);
+
+static void (*const backendFunctions[])(block *blks, unsigned nblks, GC_AES_KEY *key) = {
+  ecbEncryptSSE, ecbEncryptVAES256, ecbEncryptVAES512,
+};
+
+static bool backendSupported(GC_AES_BACKEND backend) {
+  switch (backend) {
+    case GC_AES_BACKEND_VAES512:
+      return __builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx512f");
+    case GC_AES_BACKEND_VAES256:
+      return __builtin_cpu_supports("vaes") && __builtin_cpu_supports("avx2");
+    default:
+      return true;
+  }
+}
+
+bool GC_AES_set_backend(GC_AES_BACKEND backend) {
+  __builtin_cpu_init();
+  if (!backendSupported(backend)) {
+    return false;
+  }
+
+  currentBackend = backend;
+  return true;
+}
+
+// Picks the widest backend the CPU supports, unless GC_AES_set_backend has
+// picked one already. Runs once, on whichever thread needs it first.
+static int selectBackend() {
+  static std::once_flag selected;
+  std::call_once(selected, [] {
+    __builtin_cpu_init();
+    int backend = GC_AES_BACKEND_SSE;
+    if (backendSupported(GC_AES_BACKEND_VAES512)) {
+      backend = GC_AES_BACKEND_VAES512;
+    } else if (backendSupported(GC_AES_BACKEND_VAES256)) {
+      backend = GC_AES_BACKEND_VAES256;
+    }
+    int unset = -1;
+    currentBackend.compare_exchange_strong(unset, backend);
+  });
+  return currentBackend;
+}
+
+void GC_AES_ecb_encrypt_blks_batch(block *blks, unsigned nblks, GC_AES_KEY *key) {
+  int backend = currentBackend.load(std::memory_order_acquire);
+  if (backend < 0) {
+    backend = selectBackend();
+  }
+  backendFunctions[backend](blks, nblks, key);
+}
+
+GC_AES_BACKEND GC_AES_get_backend() {
+  int backend = currentBackend;
+  if (backend < 0) {
+    backend = selectBackend();
+  }
+  return (GC_AES_BACKEND) backend;
+}
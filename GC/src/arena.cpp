@@ -0,0 +1,87 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include "include/arena.h"
+#include "include/common.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+
+using namespace std;
+
+Arena::Arena(size_t chunkSize) : chunkSize(chunkSize), current(0), offset(0) { }
+
+Arena::~Arena() {
+  for (size_t i = 0; i < chunks.size(); i++) {
+    free(chunks[i].first);
+  }
+}
+
+Arena::Mark Arena::mark() const {
+  Mark mark = { current, offset };
+  return mark;
+}
+
+void Arena::release(Mark mark) {
+  current = mark.chunk;
+  offset = mark.offset;
+}
+
+// Bumps the offset in the current chunk, moving on to the next chunk when
+// the current one is full. A kept chunk that is too small for the request
+// is replaced by a larger one.
+void *Arena::allocateBytes(size_t size, size_t alignment) {
+  while (true) {
+    if (current < chunks.size()) {
+      char *base = chunks[current].first;
+      uintptr_t start = ((uintptr_t) base + offset + alignment - 1) & ~(uintptr_t) (alignment - 1);
+      if (start + size <= (uintptr_t) base + chunks[current].second) {
+        offset = start + size - (uintptr_t) base;
+        return (void*) start;
+      }
+      if (offset == 0) {
+        // nothing of this chunk is in use, so it can be replaced
+        free(base);
+        chunks.erase(chunks.begin() + current);
+      } else {
+        current++;
+        offset = 0;
+        continue;
+      }
+    }
+
+    size_t capacity = max(chunkSize, size + alignment);
+    char *chunk = (char*) malloc(capacity);
+    if (chunk == NULL) {
+      dbgs("Memory allocation error");
+      exit(1);
+    }
+    chunks.insert(chunks.begin() + current, make_pair(chunk, capacity));
+    offset = 0;
+  }
+}
+
+Arena *getBuildArena() {
+  static thread_local Arena arena;
+  return &arena;
+}
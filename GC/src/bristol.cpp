@@ -0,0 +1,307 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "include/garble.h"
+#include "include/gates.h"
+#include "include/justGarble.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Bristol Fashion (https://homes.esat.kuleuven.be/~nsmart/MPC/) describes a
+// circuit as a header followed by one gate per line:
+//
+//   <number of gates> <number of wires>
+//   <number of input values> <bits of each input value>
+//   <number of output values> <bits of each output value>
+//
+//   <number of inputs> <number of outputs> <input wires> <output wires> <type>
+//
+// The input values occupy the first wires and the output values the last
+// ones. Types are XOR, AND, INV, EQW (a wire copy), EQ (a constant, given in
+// place of the input wire) and MAND (several AND gates on one line).
+
+namespace {
+
+struct BristolGate {
+  string type;
+  vector<int> inputs, outputs;
+};
+
+}  // namespace
+
+static bool bristolError(const char *filename, const char *msg) {
+  printf("%s: %s\n", filename, msg);
+  return false;
+}
+
+bool readBristolCircuit(GarbledCircuit *garbledCircuit, const char *filename,
+                        vector<int> *inputSizes, vector<int> *outputSizes) {
+  ifstream f(filename);
+  if (!f) {
+    return bristolError(filename, "unable to open circuit file");
+  }
+
+  int nGates, nWires, nInputValues, nOutputValues;
+  int n = 0, m = 0;
+  if (!(f >> nGates >> nWires >> nInputValues) || nGates < 0 || nWires < 0 || nInputValues < 0) {
+    return bristolError(filename, "malformed header");
+  }
+  inputSizes->resize(nInputValues);
+  for (int i = 0; i < nInputValues; i++) {
+    if (!(f >> (*inputSizes)[i]) || (*inputSizes)[i] < 0) {
+      return bristolError(filename, "malformed header");
+    }
+    n += (*inputSizes)[i];
+  }
+  if (!(f >> nOutputValues) || nOutputValues < 0) {
+    return bristolError(filename, "malformed header");
+  }
+  outputSizes->resize(nOutputValues);
+  for (int i = 0; i < nOutputValues; i++) {
+    if (!(f >> (*outputSizes)[i]) || (*outputSizes)[i] < 0) {
+      return bristolError(filename, "malformed header");
+    }
+    m += (*outputSizes)[i];
+  }
+  if (n > nWires || m > nWires) {
+    return bristolError(filename, "more inputs or outputs than wires");
+  }
+
+  // Read and check every gate before building, so that a bad file leaves
+  // garbledCircuit untouched.
+  vector<BristolGate> gates(nGates);
+  vector<char> defined(nWires, 0);
+  memset(defined.data(), 1, n);
+  int q = 0;
+  for (int g = 0; g < nGates; g++) {
+    BristolGate &gate = gates[g];
+    int nIn, nOut;
+    if (!(f >> nIn >> nOut) || nIn < 0 || nOut < 0) {
+      return bristolError(filename, "malformed gate");
+    }
+    gate.inputs.resize(nIn);
+    gate.outputs.resize(nOut);
+    for (int i = 0; i < nIn; i++) {
+      f >> gate.inputs[i];
+    }
+    for (int i = 0; i < nOut; i++) {
+      f >> gate.outputs[i];
+    }
+    if (!(f >> gate.type)) {
+      return bristolError(filename, "malformed gate");
+    }
+
+    bool binary = (gate.type == "XOR" || gate.type == "AND");
+    bool unary = (gate.type == "INV" || gate.type == "EQW" || gate.type == "EQ");
+    bool mand = (gate.type == "MAND");
+    if ((binary && (nIn != 2 || nOut != 1)) || (unary && (nIn != 1 || nOut != 1)) ||
+        (mand && nIn != 2 * nOut) || !(binary || unary || mand)) {
+      return bristolError(filename, "unsupported gate");
+    }
+
+    if (gate.type == "EQ") {
+      if (gate.inputs[0] != 0 && gate.inputs[0] != 1) {
+        return bristolError(filename, "EQ gate with a non-binary constant");
+      }
+    } else {
+      for (int i = 0; i < nIn; i++) {
+        if (gate.inputs[i] < 0 || gate.inputs[i] >= nWires || !defined[gate.inputs[i]]) {
+          return bristolError(filename, "gate reads an undefined wire");
+        }
+      }
+    }
+    for (int i = 0; i < nOut; i++) {
+      if (gate.outputs[i] < 0 || gate.outputs[i] >= nWires || defined[gate.outputs[i]]) {
+        return bristolError(filename, "gate writes an input or an already written wire");
+      }
+      defined[gate.outputs[i]] = 1;
+    }
+
+    if (binary || gate.type == "INV") {
+      q++;
+    } else if (mand) {
+      q += nOut;
+    }
+  }
+  for (int i = nWires - m; i < nWires; i++) {
+    if (!defined[i]) {
+      return bristolError(filename, "output wire is never written");
+    }
+  }
+
+  GarblingContext garblingContext;
+  createEmptyGarbledCircuit(garbledCircuit, n, m, q, nWires + 2);
+  startBuilding(garbledCircuit, &garblingContext);
+
+  // wires[w] is the wire of the circuit that carries Bristol wire w
+  vector<int> wires(nWires, -1);
+  for (int i = 0; i < n; i++) {
+    wires[i] = i;
+  }
+  int constantWires[2] = {-1, -1};
+
+  for (int g = 0; g < nGates; g++) {
+    const BristolGate &gate = gates[g];
+    const vector<int> &in = gate.inputs;
+    const vector<int> &out = gate.outputs;
+
+    if (gate.type == "EQW") {
+      wires[out[0]] = wires[in[0]];
+    } else if (gate.type == "EQ") {
+      int value = in[0];
+      if (constantWires[value] < 0) {
+        constantWires[value] = value ? fixedOneWire(garbledCircuit, &garblingContext)
+                                     : fixedZeroWire(garbledCircuit, &garblingContext);
+      }
+      wires[out[0]] = constantWires[value];
+    } else if (gate.type == "INV") {
+      wires[out[0]] = getNextWire(&garblingContext);
+      NOTGate(garbledCircuit, &garblingContext, wires[in[0]], wires[out[0]]);
+    } else if (gate.type == "XOR") {
+      wires[out[0]] = getNextWire(&garblingContext);
+      XORGate(garbledCircuit, &garblingContext, wires[in[0]], wires[in[1]], wires[out[0]]);
+    } else {
+      // AND, and MAND, whose inputs are all first inputs, then all second ones
+      int k = out.size();
+      for (int i = 0; i < k; i++) {
+        wires[out[i]] = getNextWire(&garblingContext);
+        ANDGate(garbledCircuit, &garblingContext, wires[in[i]], wires[in[k + i]], wires[out[i]]);
+      }
+    }
+  }
+
+  int *outputs = new int[m];
+  for (int i = 0; i < m; i++) {
+    outputs[i] = wires[nWires - m + i];
+  }
+  finishBuilding(garbledCircuit, &garblingContext, outputs);
+  delete[] outputs;
+
+  return true;
+}
+
+namespace {
+
+// Writes the gates of a finished circuit in Bristol Fashion. Label slots are
+// reused by the circuit, so each gate output is given a new Bristol wire.
+class BristolWriter {
+ public:
+  explicit BristolWriter(int nInputs) : nextWire(nInputs), nGates(0) { }
+
+  // Writes the gates of garbledCircuit. slotWires maps its input slots to
+  // Bristol wires on entry, and maps all of its slots to wires on return.
+  void writeGates(GarbledCircuit *garbledCircuit, vector<int> &slotWires) {
+    for (uint32_t i = 0; i < garbledCircuit->fixedWireIndices.size(); i++) {
+      const pair<int, int> &w = garbledCircuit->fixedWireIndices[i];
+      slotWires[w.first] = nextWire;
+      gates << "1 1 " << (w.second == FIXED_ONE_GATE ? 1 : 0) << " " << nextWire++ << " EQ\n";
+      nGates++;
+    }
+
+    for (int i = 0; i < garbledCircuit->q; i++) {
+      GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
+      int input0 = slotWires[garbledGate->input0];
+      int input1 = slotWires[garbledGate->input1];
+      int output = nextWire++;
+
+      if (garbledGate->type == NOTGATE) {
+        gates << "1 1 " << input0 << " " << output << " INV\n";
+      } else {
+        gates << "2 1 " << input0 << " " << input1 << " " << output
+              << (garbledGate->type == ANDGATE ? " AND\n" : " XOR\n");
+      }
+      slotWires[garbledGate->output] = output;
+      nGates++;
+    }
+  }
+
+  // Copies wire to the next wire, so that the outputs end up last.
+  void writeOutput(int wire) {
+    gates << "1 1 " << wire << " " << nextWire++ << " EQW\n";
+    nGates++;
+  }
+
+  int nextWire, nGates;
+  ostringstream gates;
+};
+
+}  // namespace
+
+static void writeSizes(ofstream &f, const vector<int> &sizes) {
+  f << sizes.size();
+  for (size_t i = 0; i < sizes.size(); i++) {
+    f << " " << sizes[i];
+  }
+  f << "\n";
+}
+
+bool writeBristolCircuit(GarbledCircuit *garbledCircuit, const char *filename,
+                         const vector<int> &inputSizes, const vector<int> &outputSizes) {
+  int n = 0, m = 0;
+  for (size_t i = 0; i < inputSizes.size(); i++) {
+    n += inputSizes[i];
+  }
+  for (size_t i = 0; i < outputSizes.size(); i++) {
+    m += outputSizes[i];
+  }
+  if (n != garbledCircuit->n || m != garbledCircuit->m) {
+    return bristolError(filename, "input or output sizes do not match the circuit");
+  }
+
+  BristolWriter writer(n);
+  vector<int> slotWires(garbledCircuit->r, -1);
+  ReplicatedStage *stage = garbledCircuit->stage;
+  if (stage == NULL) {
+    for (int i = 0; i < n; i++) {
+      slotWires[garbledCircuit->inputWires[i]] = i;
+    }
+  } else {
+    // every instance of the stage is written out in full
+    GarbledCircuit *instance = &(stage->instance);
+    vector<int> instanceWires(instance->r);
+    for (int e = 0; e < stage->nInstances; e++) {
+      for (int j = 0; j < instance->n; j++) {
+        instanceWires[instance->inputWires[j]] = stage->inputOffsets[j] + e * stage->inputStrides[j];
+      }
+      writer.writeGates(instance, instanceWires);
+      for (int j = 0; j < instance->m; j++) {
+        int input = stage->outputOffsets[j] + e * stage->outputStrides[j];
+        slotWires[garbledCircuit->inputWires[input]] = instanceWires[instance->outputs[j]];
+      }
+    }
+  }
+  writer.writeGates(garbledCircuit, slotWires);
+  for (int i = 0; i < m; i++) {
+    writer.writeOutput(slotWires[garbledCircuit->outputs[i]]);
+  }
+
+  ofstream f(filename);
+  if (!f) {
+    return bristolError(filename, "unable to open circuit file");
+  }
+  f << writer.nGates << " " << writer.nextWire << "\n";
+  writeSizes(f, inputSizes);
+  writeSizes(f, outputSizes);
+  f << "\n" << writer.gates.str();
+  return (bool) f;
+}
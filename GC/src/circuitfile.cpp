@@ -0,0 +1,333 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "include/garble.h"
+#include "include/justGarble.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+// A circuit file starts with a CircuitFileHeader, which describes the circuit
+// and its replicated stage (if any) through CircuitRecords. Every array that
+// follows starts at an offset that is a multiple of CIRCUIT_FILE_ALIGNMENT,
+// so that the gates can be used in place once the file is mapped. Bump
+// CIRCUIT_FILE_VERSION whenever the layout, or anything finishBuilding does
+// to a circuit, changes, so that stale files are rebuilt.
+#define CIRCUIT_FILE_MAGIC "JGCIRC"
+#define CIRCUIT_FILE_VERSION 2
+#define CIRCUIT_FILE_KEY_LENGTH 64
+#define CIRCUIT_FILE_ALIGNMENT 64
+
+typedef struct {
+  int32_t n, m, q, r, nAndGates, nFixed, nRuns, unused;
+  int64_t gates, outputs, inputWires, fixedWires, runs;
+} CircuitRecord;
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t hasStage;
+  char key[CIRCUIT_FILE_KEY_LENGTH];
+  int64_t fileSize;
+  CircuitRecord circuit;
+  CircuitRecord instance;
+  int32_t nInstances, nInputs, unused[2];
+  int64_t inputOffsets, inputStrides, outputOffsets, outputStrides;
+} CircuitFileHeader;
+
+// Reserves bytes at the end of the file being laid out and returns their
+// offset.
+static int64_t reserve(int64_t *fileSize, size_t bytes) {
+  int64_t offset = (*fileSize + CIRCUIT_FILE_ALIGNMENT - 1) / CIRCUIT_FILE_ALIGNMENT * CIRCUIT_FILE_ALIGNMENT;
+  *fileSize = offset + bytes;
+  return offset;
+}
+
+static void layoutRecord(GarbledCircuit *garbledCircuit, int nInputWires, CircuitRecord *record, int64_t *fileSize) {
+  memset(record, 0, sizeof(CircuitRecord));
+  record->n = nInputWires;
+  record->m = garbledCircuit->m;
+  record->q = garbledCircuit->q;
+  record->r = garbledCircuit->r;
+  record->nAndGates = garbledCircuit->nAndGates;
+  record->nFixed = garbledCircuit->fixedWireIndices.size();
+  record->nRuns = garbledCircuit->runs.size();
+
+  record->gates = reserve(fileSize, sizeof(GarbledGate) * record->q);
+  record->outputs = reserve(fileSize, sizeof(int) * record->m);
+  record->inputWires = reserve(fileSize, sizeof(int) * record->n);
+  record->fixedWires = reserve(fileSize, sizeof(pair<int, int>) * record->nFixed);
+  record->runs = reserve(fileSize, sizeof(GateRun) * record->nRuns);
+}
+
+// Writes bytes at offset, padding the file with zeros up to offset.
+static bool writeAt(FILE *f, int64_t offset, const void *data, size_t bytes) {
+  static const char zeros[CIRCUIT_FILE_ALIGNMENT] = {0};
+  long position = ftell(f);
+  if (position < 0 || position > offset ||
+      fwrite(zeros, 1, offset - position, f) != (size_t) (offset - position)) {
+    return false;
+  }
+  return bytes == 0 || fwrite(data, 1, bytes, f) == bytes;
+}
+
+static bool writeRecord(FILE *f, GarbledCircuit *garbledCircuit, const CircuitRecord *record) {
+  return writeAt(f, record->gates, garbledCircuit->garbledGates, sizeof(GarbledGate) * record->q) &&
+         writeAt(f, record->outputs, garbledCircuit->outputs, sizeof(int) * record->m) &&
+         writeAt(f, record->inputWires, garbledCircuit->inputWires, sizeof(int) * record->n) &&
+         writeAt(f, record->fixedWires, garbledCircuit->fixedWireIndices.data(),
+                 sizeof(pair<int, int>) * record->nFixed) &&
+         writeAt(f, record->runs, garbledCircuit->runs.data(), sizeof(GateRun) * record->nRuns);
+}
+
+bool saveCircuit(GarbledCircuit *garbledCircuit, const char *filename, const char *key) {
+  if (strlen(key) >= CIRCUIT_FILE_KEY_LENGTH) {
+    dbgs("circuit file key is too long");
+    return false;
+  }
+
+  CircuitFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CIRCUIT_FILE_MAGIC, sizeof(CIRCUIT_FILE_MAGIC));
+  header.version = CIRCUIT_FILE_VERSION;
+  strcpy(header.key, key);
+
+  ReplicatedStage *stage = garbledCircuit->stage;
+  int64_t fileSize = sizeof(header);
+  if (stage == NULL) {
+    layoutRecord(garbledCircuit, garbledCircuit->n, &(header.circuit), &fileSize);
+  } else {
+    GarbledCircuit *instance = &(stage->instance);
+    header.hasStage = 1;
+    header.nInstances = stage->nInstances;
+    header.nInputs = garbledCircuit->n;
+    layoutRecord(garbledCircuit, stage->nBodyInputs, &(header.circuit), &fileSize);
+    // addReplicatedStage adds the tables of the stage again on loading
+    header.circuit.nAndGates -= stage->nInstances * instance->nAndGates;
+    layoutRecord(instance, instance->n, &(header.instance), &fileSize);
+    header.inputOffsets = reserve(&fileSize, sizeof(int) * instance->n);
+    header.inputStrides = reserve(&fileSize, sizeof(int) * instance->n);
+    header.outputOffsets = reserve(&fileSize, sizeof(int) * instance->m);
+    header.outputStrides = reserve(&fileSize, sizeof(int) * instance->m);
+  }
+  header.fileSize = fileSize;
+
+  string tmpFilename = string(filename) + "." + to_string(getpid()) + ".tmp";
+  FILE *f = fopen(tmpFilename.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+
+  bool ok = writeAt(f, 0, &header, sizeof(header)) &&
+            writeRecord(f, garbledCircuit, &(header.circuit));
+  if (ok && stage != NULL) {
+    GarbledCircuit *instance = &(stage->instance);
+    ok = writeRecord(f, instance, &(header.instance)) &&
+         writeAt(f, header.inputOffsets, stage->inputOffsets, sizeof(int) * instance->n) &&
+         writeAt(f, header.inputStrides, stage->inputStrides, sizeof(int) * instance->n) &&
+         writeAt(f, header.outputOffsets, stage->outputOffsets, sizeof(int) * instance->m) &&
+         writeAt(f, header.outputStrides, stage->outputStrides, sizeof(int) * instance->m);
+  }
+  ok = (fclose(f) == 0) && ok;
+
+  if (!ok || rename(tmpFilename.c_str(), filename) != 0) {
+    unlink(tmpFilename.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool validSection(const CircuitFileHeader *header, int64_t offset, int64_t count, size_t size) {
+  return count >= 0 && offset >= (int64_t) sizeof(CircuitFileHeader) &&
+         offset % CIRCUIT_FILE_ALIGNMENT == 0 && offset + count * (int64_t) size <= header->fileSize;
+}
+
+static bool validRecord(const CircuitFileHeader *header, const CircuitRecord *record) {
+  return validSection(header, record->gates, record->q, sizeof(GarbledGate)) &&
+         validSection(header, record->outputs, record->m, sizeof(int)) &&
+         validSection(header, record->inputWires, record->n, sizeof(int)) &&
+         validSection(header, record->fixedWires, record->nFixed, sizeof(pair<int, int>)) &&
+         validSection(header, record->runs, record->nRuns, sizeof(GateRun));
+}
+
+static bool validWires(const int *wires, int count, int r) {
+  for (int i = 0; i < count; i++) {
+    if (wires[i] < 0 || wires[i] >= r) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Checks that every wire a record refers to is below r and that its runs
+// cover the gates [0, q) in order with as many AND gates as it has tables,
+// so that a corrupted file cannot make garbleCircuit or evaluate write
+// outside the label or table arrays. validRecord must hold.
+static bool validContents(const char *base, const CircuitRecord *record) {
+  int r = record->r;
+  if (r < 0 || record->nAndGates < 0) {
+    return false;
+  }
+
+  const GarbledGate *gates = (const GarbledGate*) (base + record->gates);
+  for (int i = 0; i < record->q; i++) {
+    if (gates[i].input0 >= (uint32_t) r || gates[i].input1 >= (uint32_t) r || gates[i].output >= (uint32_t) r) {
+      return false;
+    }
+  }
+  if (!validWires((const int*) (base + record->outputs), record->m, r) ||
+      !validWires((const int*) (base + record->inputWires), record->n, r)) {
+    return false;
+  }
+
+  const pair<int, int> *fixedWires = (const pair<int, int>*) (base + record->fixedWires);
+  for (int i = 0; i < record->nFixed; i++) {
+    if (fixedWires[i].first < 0 || fixedWires[i].first >= r ||
+        (fixedWires[i].second != FIXED_ZERO_GATE && fixedWires[i].second != FIXED_ONE_GATE)) {
+      return false;
+    }
+  }
+
+  const GateRun *runs = (const GateRun*) (base + record->runs);
+  int next = 0;
+  long nAndGates = 0;
+  for (int k = 0; k < record->nRuns; k++) {
+    const GateRun &run = runs[k];
+    if (run.start != next || run.count <= 0 || run.count > record->q - next ||
+        (run.type != XORGATE && run.type != NOTGATE && run.type != ANDGATE)) {
+      return false;
+    }
+    for (int i = run.start; i < run.start + run.count; i++) {
+      if (gates[i].type != run.type) {
+        return false;
+      }
+    }
+    if (run.type == ANDGATE) {
+      nAndGates += run.count;
+    }
+    next += run.count;
+  }
+  return next == record->q && nAndGates == record->nAndGates;
+}
+
+// Checks that offsets[j] + e * strides[j] is below limit for every instance
+// e of a replicated stage.
+static bool validStrided(const int *offsets, const int *strides, int count, int nInstances, int limit) {
+  for (int j = 0; j < count && nInstances > 0; j++) {
+    long first = offsets[j];
+    long last = offsets[j] + (long) (nInstances - 1) * strides[j];
+    if (first < 0 || first >= limit || last < 0 || last >= limit) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Sets up garbledCircuit from a record of a mapped file. The gates, outputs
+// and input wires stay in the mapping.
+static void loadRecord(GarbledCircuit *garbledCircuit, const char *base, const CircuitRecord *record) {
+  *garbledCircuit = GarbledCircuit();
+  garbledCircuit->n = record->n;
+  garbledCircuit->m = record->m;
+  garbledCircuit->q = record->q;
+  garbledCircuit->r = record->r;
+  garbledCircuit->nAndGates = record->nAndGates;
+  garbledCircuit->mapped = true;
+
+  garbledCircuit->garbledGates = (GarbledGate*) (base + record->gates);
+  garbledCircuit->outputs = (int*) (base + record->outputs);
+  garbledCircuit->inputWires = (int*) (base + record->inputWires);
+
+  const pair<int, int> *fixedWires = (const pair<int, int>*) (base + record->fixedWires);
+  garbledCircuit->fixedWireIndices.assign(fixedWires, fixedWires + record->nFixed);
+  const GateRun *runs = (const GateRun*) (base + record->runs);
+  garbledCircuit->runs.assign(runs, runs + record->nRuns);
+}
+
+bool loadCircuit(GarbledCircuit *garbledCircuit, const char *filename, const char *key) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(CircuitFileHeader)) {
+    close(fd);
+    return false;
+  }
+
+  void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  const char *base = (const char*) mapping;
+  const CircuitFileHeader *header = (const CircuitFileHeader*) mapping;
+  bool ok = memcmp(header->magic, CIRCUIT_FILE_MAGIC, sizeof(CIRCUIT_FILE_MAGIC)) == 0 &&
+            header->version == CIRCUIT_FILE_VERSION &&
+            strncmp(header->key, key, CIRCUIT_FILE_KEY_LENGTH) == 0 &&
+            header->fileSize == st.st_size &&
+            validRecord(header, &(header->circuit)) &&
+            validContents(base, &(header->circuit));
+  if (ok && header->hasStage) {
+    int nInstanceInputs = header->instance.n;
+    int nInstanceOutputs = header->instance.m;
+    ok = header->nInstances >= 0 && header->nInputs >= 0 &&
+         validRecord(header, &(header->instance)) &&
+         validContents(base, &(header->instance)) &&
+         validSection(header, header->inputOffsets, nInstanceInputs, sizeof(int)) &&
+         validSection(header, header->inputStrides, nInstanceInputs, sizeof(int)) &&
+         validSection(header, header->outputOffsets, nInstanceOutputs, sizeof(int)) &&
+         validSection(header, header->outputStrides, nInstanceOutputs, sizeof(int));
+    // instance inputs come from the inputs of the whole circuit, and
+    // instance outputs go to the input wires of the rest of it
+    ok = ok &&
+         validStrided((const int*) (base + header->inputOffsets), (const int*) (base + header->inputStrides),
+                      nInstanceInputs, header->nInstances, header->nInputs) &&
+         validStrided((const int*) (base + header->outputOffsets), (const int*) (base + header->outputStrides),
+                      nInstanceOutputs, header->nInstances, header->circuit.n);
+  }
+  if (!ok) {
+    munmap(mapping, st.st_size);
+    return false;
+  }
+
+  loadRecord(garbledCircuit, base, &(header->circuit));
+  if (header->hasStage) {
+    GarbledCircuit instance;
+    loadRecord(&instance, base, &(header->instance));
+    addReplicatedStage(garbledCircuit, &instance, header->nInstances, header->nInputs,
+                       (int*) (base + header->inputOffsets), (int*) (base + header->inputStrides),
+                       (int*) (base + header->outputOffsets), (int*) (base + header->outputStrides));
+  }
+  garbledCircuit->mapping = mapping;
+  garbledCircuit->mappingSize = st.st_size;
+
+  return true;
+}
@@ -19,10 +19,12 @@
  */
 
 #include "include/garble.h"
+#include "include/circuits.h"
 #include "include/common.h"
 #include "include/gates.h"
 #include "include/util.h"
 #include "include/justGarble.h"
+#include "include/arena.h"
 
 static void ADD22Circuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int *inputs, int *outputs) {
   int wire1 = getNextWire(garblingContext);
@@ -52,7 +54,99 @@ static void ADD32Circuit(GarbledCircuit *garbledCircuit, GarblingContext *garbli
   outputs[1] = wire5;
 }
 
-void ADDCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs) {
+static int newANDGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int input0, int input1) {
+  int wire = getNextWire(garblingContext);
+  ANDGate(garbledCircuit, garblingContext, input0, input1, wire);
+  return wire;
+}
+
+static int newXORGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int input0, int input1) {
+  int wire = getNextWire(garblingContext);
+  XORGate(garbledCircuit, garblingContext, input0, input1, wire);
+  return wire;
+}
+
+// Combines the (generate, propagate) pair of bits [j+1, i] with that of a
+// lower, adjacent range ending at bit j, so that (G[i], P[i]) covers both.
+// The two terms of G never both hold, so their OR is an XOR. A P that is
+// never read again is removed with the other dead gates by optimizeCircuit.
+static void combineCarry(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int *G, int *P, int i, int j) {
+  int wire = newANDGate(garbledCircuit, garblingContext, P[i], G[j]);
+  G[i] = newXORGate(garbledCircuit, garblingContext, G[i], wire);
+  P[i] = newANDGate(garbledCircuit, garblingContext, P[i], P[j]);
+}
+
+// Turns the (generate, propagate) bits of m positions into their prefixes
+// with a Brent-Kung or Sklansky network, so that G[i] is the carry out of
+// bits [0, i].
+static void prefixCarries(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int m, int *G, int *P,
+                          CircuitShape shape) {
+  if (shape == SHAPE_BRENT_KUNG) {
+    int step = 1;
+    for (; 2 * step <= m; step *= 2) {
+      for (int i = 2 * step - 1; i < m; i += 2 * step) {
+        combineCarry(garbledCircuit, garblingContext, G, P, i, i - step);
+      }
+    }
+    for (step /= 2; step >= 1; step /= 2) {
+      for (int i = 3 * step - 1; i < m; i += 2 * step) {
+        combineCarry(garbledCircuit, garblingContext, G, P, i, i - step);
+      }
+    }
+  } else {
+    // Sklansky: every position in the upper half of a block of 2 * step
+    // takes in the top of the lower half
+    for (int step = 1; step < m; step *= 2) {
+      for (int i = 0; i < m; i++) {
+        if (i & step) {
+          combineCarry(garbledCircuit, garblingContext, G, P, i, (i & ~(2 * step - 1)) + step - 1);
+        }
+      }
+    }
+  }
+}
+
+// Combines the (generate, propagate) bits of positions [lo, hi] into G[hi]
+// and P[hi], as a balanced tree of depth ceil(log2(hi - lo + 1)).
+static void reduceCarries(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int *G, int *P,
+                          int lo, int hi) {
+  if (lo == hi) {
+    return;
+  }
+  int mid = (lo + hi) / 2;
+  reduceCarries(garbledCircuit, garblingContext, G, P, lo, mid);
+  reduceCarries(garbledCircuit, garblingContext, G, P, mid + 1, hi);
+  combineCarry(garbledCircuit, garblingContext, G, P, hi, mid);
+}
+
+// Adds two k-bit values with a parallel-prefix carry network.
+static void ADDPrefixCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs,
+                             int *outputs, CircuitShape shape) {
+  int split = n / 2;
+  ArenaScope scratch(garblingContext->arena);
+  int *G = scratch.allocate<int>(split);
+  int *P = scratch.allocate<int>(split);
+  for (int i = 0; i < split; i++) {
+    P[i] = newXORGate(garbledCircuit, garblingContext, inputs[i], inputs[split + i]);
+    outputs[i] = P[i];
+  }
+  // the carry out of the top bit is dropped
+  for (int i = 0; i < split - 1; i++) {
+    G[i] = newANDGate(garbledCircuit, garblingContext, inputs[i], inputs[split + i]);
+  }
+  prefixCarries(garbledCircuit, garblingContext, split - 1, G, P, shape);
+  for (int i = 1; i < split; i++) {
+    outputs[i] = newXORGate(garbledCircuit, garblingContext, outputs[i], G[i - 1]);
+  }
+
+}
+
+void ADDCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs, CircuitShape shape) {
+  if (shape != SHAPE_CHAIN) {
+    ADDPrefixCircuit(garbledCircuit, garblingContext, n, inputs, outputs, shape);
+    return;
+  }
+
   int split = n / 2;
   int tempIn[3];
   int tempOut[2];
@@ -71,8 +165,50 @@ void ADDCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext
   }
 }
 
-void EQCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs) {
+// ORs the wires inputs[lo..hi] together in a balanced tree.
+static int ORTree(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int *inputs, int lo, int hi) {
+  if (lo == hi) {
+    return inputs[lo];
+  }
+  int mid = (lo + hi) / 2;
+  int wire1 = ORTree(garbledCircuit, garblingContext, inputs, lo, mid);
+  int wire2 = ORTree(garbledCircuit, garblingContext, inputs, mid + 1, hi);
+  int wire3 = getNextWire(garblingContext);
+  ORGate(garbledCircuit, garblingContext, wire1, wire2, wire3);
+  return wire3;
+}
+
+// Computes the OR of all n input wires, which is 0 only if they all are
+// (a zero test).
+void ORReduceCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs, CircuitShape shape) {
+  if (shape != SHAPE_CHAIN) {
+    outputs[0] = ORTree(garbledCircuit, garblingContext, inputs, 0, n - 1);
+    return;
+  }
+
+  int tempOut = inputs[0];
+  for (int i = 1; i < n; i++) {
+    int wire = getNextWire(garblingContext);
+    ORGate(garbledCircuit, garblingContext, tempOut, inputs[i], wire);
+    tempOut = wire;
+  }
+  outputs[0] = tempOut;
+}
+
+void EQCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs, CircuitShape shape) {
   int split = n / 2;
+  if (shape != SHAPE_CHAIN) {
+    // equal if no bit differs
+    ArenaScope scratch(garblingContext->arena);
+    int *diffs = scratch.allocate<int>(split);
+    for (int i = 0; i < split; i++) {
+      diffs[i] = newXORGate(garbledCircuit, garblingContext, inputs[i], inputs[split + i]);
+    }
+    int anyDiff;
+    ORReduceCircuit(garbledCircuit, garblingContext, split, diffs, &anyDiff, shape);
+    outputs[0] = newXORGate(garbledCircuit, garblingContext, anyDiff, fixedOneWire(garbledCircuit, garblingContext));
+    return;
+  }
 
   int tempOut = fixedOneWire(garbledCircuit, garblingContext);
   for (int i = 0; i < split; i++) {
@@ -111,10 +247,33 @@ static void CMP31Circuit(GarbledCircuit *garbledCircuit, GarblingContext *garbli
   outputs[0] = wire4;
 }
 
-void CMPCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs) {
+// Compares two k-bit values with a balanced tree. Bit i of a generates a
+// "greater" if it is 1 and bit i of b is 0, and propagates the comparison of
+// the lower bits if the two are equal.
+static void CMPTreeCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs,
+                           int *outputs) {
+  int split = n / 2;
+  ArenaScope scratch(garblingContext->arena);
+  int *G = scratch.allocate<int>(split);
+  int *P = scratch.allocate<int>(split);
+  int oneWire = fixedOneWire(garbledCircuit, garblingContext);
+  for (int i = 0; i < split; i++) {
+    int diff = newXORGate(garbledCircuit, garblingContext, inputs[i], inputs[split + i]);
+    G[i] = newANDGate(garbledCircuit, garblingContext, inputs[i], diff);
+    P[i] = newXORGate(garbledCircuit, garblingContext, diff, oneWire);
+  }
+  reduceCarries(garbledCircuit, garblingContext, G, P, 0, split - 1);
+  outputs[0] = G[split - 1];
+}
+
+void CMPCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs, CircuitShape shape) {
   int split = n / 2;
   int tempIn[3];
   int tempOut;
+  if (shape != SHAPE_CHAIN) {
+    CMPTreeCircuit(garbledCircuit, garblingContext, n, inputs, outputs);
+    return;
+  }
 
   tempIn[0] = inputs[0];
   tempIn[1] = inputs[split];
@@ -148,20 +307,19 @@ void MUXCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext
   }
 }
 
-void MAXCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs) {
+void MAXCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int n, int *inputs, int *outputs, CircuitShape shape) {
   int nbits = n / 2;
-  int *muxInput = new int[n + 1];
+  ArenaScope scratch(garblingContext->arena);
+  int *muxInput = scratch.allocate<int>(n + 1);
   memcpy(muxInput, inputs + nbits, nbits*sizeof(int));
   memcpy(muxInput + nbits, inputs, nbits*sizeof(int));
 
-  CMPCircuit(garbledCircuit, garblingContext, n, inputs, &muxInput[n]);
+  CMPCircuit(garbledCircuit, garblingContext, n, inputs, &muxInput[n], shape);
   MUXCircuit(garbledCircuit, garblingContext, n + 1, muxInput, outputs);
-
-  delete[] muxInput;
 }
 
 // Computes the maximum element in a vector of k-bit values
-void MAXVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs) {
+void MAXVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape) {
   if (n == 0 || n % k != 0) {
     dbgs("input must be a non-empty vector of k-bit values");
     exit(1);
@@ -170,105 +328,246 @@ void MAXVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingCont
   int nElems = n / k;
   if (nElems == 1) {
     memcpy(outputs, inputs, sizeof(int) * n);
+    return;
   }
 
   int tempIn[2 * k];
   int tempOut[k];
   memcpy(tempIn, inputs, sizeof(int) * 2 * k);
-  MAXCircuit(garbledCircuit, garblingContext, 2 * k, tempIn, tempOut);
+  MAXCircuit(garbledCircuit, garblingContext, 2 * k, tempIn, tempOut, shape);
 
   for (int i = 2; i < nElems; i++) {  
     memcpy(tempIn, tempOut, sizeof(int) * k);
     memcpy(tempIn + k, inputs + k * i, sizeof(int) * k);
-    MAXCircuit(garbledCircuit, garblingContext, 2 * k, tempIn, tempOut);
+    MAXCircuit(garbledCircuit, garblingContext, 2 * k, tempIn, tempOut, shape);
   }
 
   memcpy(outputs, tempOut, sizeof(int) * k);
 }
 
-// Computes the max and all of the arg-maxes in a vector of k-bit values
-// (represented as a bit-string)
-void ARGMAXVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs) {
+// Computes the maximum element in a vector of k-bit values by comparing
+// pairs of elements in a tournament tree. This uses as many comparisons as
+// MAXVecCircuit, but they are only log(n / k) deep, so that the comparisons
+// of each round can be garbled and evaluated in parallel.
+void MAXVecTreeCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape) {
   if (n == 0 || n % k != 0) {
     dbgs("input must be a non-empty vector of k-bit values");
     exit(1);
   }
 
+  int nElems = n / k;
+  ArenaScope scratch(garblingContext->arena);
+  int *round = scratch.allocate<int>(n);
+  memcpy(round, inputs, sizeof(int) * n);
+
+  while (nElems > 1) {
+    // the winner of each pair moves to the front; an odd element out gets a bye
+    for (int i = 0; i < nElems / 2; i++) {
+      int tempOut[k];
+      MAXCircuit(garbledCircuit, garblingContext, 2 * k, round + 2 * k * i, tempOut, shape);
+      memcpy(round + k * i, tempOut, sizeof(int) * k);
+    }
+    if (nElems % 2 == 1) {
+      memmove(round + k * (nElems / 2), round + k * (nElems - 1), sizeof(int) * k);
+    }
+    nElems = (nElems + 1) / 2;
+  }
+
+  memcpy(outputs, round, sizeof(int) * k);
+}
+
+// Compares every element of a vector of k-bit values with its maximum, which
+// is on the wires maxWires, and outputs the arg-maxes followed by the max.
+static void ARGMAXFromMaxCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n,
+                                 int *inputs, int *maxWires, int *outputs, CircuitShape shape) {
   int nElems = n / k;
   int eqInputs[2*k];
+  memcpy(eqInputs + k, maxWires, sizeof(int) * k);
 
-  MAXVecCircuit(garbledCircuit, garblingContext, k, n, inputs, eqInputs + k);
-  
   for (int i = 0; i < nElems; i++) {
     memcpy(eqInputs, inputs + k * i, sizeof(int) * k);
-    EQCircuit(garbledCircuit, garblingContext, 2*k, eqInputs, &outputs[i]);
+    EQCircuit(garbledCircuit, garblingContext, 2*k, eqInputs, &outputs[i], shape);
   }
-  memcpy(outputs + nElems, eqInputs + k, sizeof(int) * k);
+  memcpy(outputs + nElems, maxWires, sizeof(int) * k);
 }
 
-// Computes the max and all of the arg-maxes in an additively-shared vector of k-bit
-// values (represented as a bit-string)
-void ARGMAXVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs) {
-  if (n == 0 || n % 2 != 0 || n % (2 * k) != 0) {
-    dbgs("input must be two non-empty vectors of k-bit values");
+// Computes the max and all of the arg-maxes in a vector of k-bit values
+// (represented as a bit-string)
+void ARGMAXVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape) {
+  if (n == 0 || n % k != 0) {
+    dbgs("input must be a non-empty vector of k-bit values");
+    exit(1);
+  }
+
+  int maxWires[k];
+  MAXVecCircuit(garbledCircuit, garblingContext, k, n, inputs, maxWires, shape);
+  ARGMAXFromMaxCircuit(garbledCircuit, garblingContext, k, n, inputs, maxWires, outputs, shape);
+}
+
+// As ARGMAXVecCircuit, but finds the max with MAXVecTreeCircuit.
+void ARGMAXVecTreeCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape) {
+  if (n == 0 || n % k != 0) {
+    dbgs("input must be a non-empty vector of k-bit values");
     exit(1);
   }
 
-  int *summedVector = new int[n / 2];
-  int sharesVec[2*k];
+  int maxWires[k];
+  MAXVecTreeCircuit(garbledCircuit, garblingContext, k, n, inputs, maxWires, shape);
+  ARGMAXFromMaxCircuit(garbledCircuit, garblingContext, k, n, inputs, maxWires, outputs, shape);
+}
+
+// Computes the max of a vector of k-bit values and the index of the element
+// that attains it. The elements are compared in a tournament tree, as in
+// MAXVecTreeCircuit, and the winner of each comparison carries its index
+// along with its value. The winner of a round-r comparison of elements 2i
+// and 2i + 1 is element i of the next round, so bit r of its index is the
+// result of the comparison. Ties go to the element with the smaller index.
+// The outputs are the ceil(log2(n / k)) index bits (least significant bit
+// first) followed by the max.
+void ARGMAXIndexVecCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape) {
+  if (n == 0 || n % k != 0) {
+    dbgs("input must be a non-empty vector of k-bit values");
+    exit(1);
+  }
+
+  int nElems = n / k;
+  int nIndexBits = 0;
+  while ((1 << nIndexBits) < nElems) {
+    nIndexBits++;
+  }
+
+  ArenaScope scratch(garblingContext->arena);
+  int *values = scratch.allocate<int>(n);
+  int *indices = scratch.allocate<int>(nElems * nIndexBits + 1);
+  memcpy(values, inputs, sizeof(int) * n);
+
+  int cmpInputs[2*k];
+  int *muxInputs = scratch.allocate<int>(2 * (k + nIndexBits) + 1);
+  int *muxOutputs = scratch.allocate<int>(k + nIndexBits);
+
+  for (int round = 0; nElems > 1; round++) {
+    int l = k + round;
+    for (int i = 0; i < nElems / 2; i++) {
+      int *left = values + k * 2 * i;
+      int *right = values + k * (2 * i + 1);
+      int *leftIndex = indices + nIndexBits * 2 * i;
+      int *rightIndex = indices + nIndexBits * (2 * i + 1);
+
+      // the right element wins only if it is strictly larger
+      memcpy(cmpInputs, right, sizeof(int) * k);
+      memcpy(cmpInputs + k, left, sizeof(int) * k);
+      int sel;
+      CMPCircuit(garbledCircuit, garblingContext, 2 * k, cmpInputs, &sel, shape);
+
+      memcpy(muxInputs, left, sizeof(int) * k);
+      memcpy(muxInputs + k, leftIndex, sizeof(int) * round);
+      memcpy(muxInputs + l, right, sizeof(int) * k);
+      memcpy(muxInputs + l + k, rightIndex, sizeof(int) * round);
+      muxInputs[2 * l] = sel;
+      MUXCircuit(garbledCircuit, garblingContext, 2 * l + 1, muxInputs, muxOutputs);
+
+      memcpy(values + k * i, muxOutputs, sizeof(int) * k);
+      memcpy(indices + nIndexBits * i, muxOutputs + k, sizeof(int) * round);
+      indices[nIndexBits * i + round] = sel;
+    }
+    if (nElems % 2 == 1) {
+      int last = nElems - 1, to = nElems / 2;
+      memmove(values + k * to, values + k * last, sizeof(int) * k);
+      memmove(indices + nIndexBits * to, indices + nIndexBits * last, sizeof(int) * round);
+      indices[nIndexBits * to + round] = fixedZeroWire(garbledCircuit, garblingContext);
+    }
+    nElems = (nElems + 1) / 2;
+  }
+
+  memcpy(outputs, indices, sizeof(int) * nIndexBits);
+  memcpy(outputs + nIndexBits, values, sizeof(int) * k);
+}
+
+// Adds the two additively-shared vectors of k-bit values in inputs.
+static void addSharesCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n,
+                             int *inputs, int *summedVector, CircuitShape shape) {
   int nElems = n / (2 * k);
   int split = n / 2;
-  for (int i = 0; i < nElems; i++) {
+  buildElements(garbledCircuit, garblingContext, nElems,
+                [=](GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int i) {
+    int sharesVec[2*k];
     memcpy(sharesVec, inputs + k*i, sizeof(int) * k);
     memcpy(sharesVec + k, inputs + split + k*i, sizeof(int) * k);
-    ADDCircuit(garbledCircuit, garblingContext, 2*k, sharesVec, summedVector + k*i);  
+    ADDCircuit(garbledCircuit, garblingContext, 2*k, sharesVec, summedVector + k*i, shape);
+  });
+}
+
+// Computes the max and all of the arg-maxes in an additively-shared vector of k-bit
+// values (represented as a bit-string)
+void ARGMAXVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape) {
+  if (n == 0 || n % 2 != 0 || n % (2 * k) != 0) {
+    dbgs("input must be two non-empty vectors of k-bit values");
+    exit(1);
   }
-  ARGMAXVecCircuit(garbledCircuit, garblingContext, k, n / 2, summedVector, outputs);
 
-  delete[] summedVector;
+  ArenaScope scratch(garblingContext->arena);
+  int *summedVector = scratch.allocate<int>(n / 2);
+  addSharesCircuit(garbledCircuit, garblingContext, k, n, inputs, summedVector, shape);
+  ARGMAXVecCircuit(garbledCircuit, garblingContext, k, n / 2, summedVector, outputs, shape);
 }
 
-void SetDiffVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs) {
+// As ARGMAXVecSharedCircuit, but finds the max with MAXVecTreeCircuit.
+void ARGMAXVecSharedTreeCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape) {
+  if (n == 0 || n % 2 != 0 || n % (2 * k) != 0) {
+    dbgs("input must be two non-empty vectors of k-bit values");
+    exit(1);
+  }
+
+  ArenaScope scratch(garblingContext->arena);
+  int *summedVector = scratch.allocate<int>(n / 2);
+  addSharesCircuit(garbledCircuit, garblingContext, k, n, inputs, summedVector, shape);
+  ARGMAXVecTreeCircuit(garbledCircuit, garblingContext, k, n / 2, summedVector, outputs, shape);
+}
+
+void SetDiffVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape) {
   if (n == 0 || n % 2 != 0 || n % (2 * k + 2) != 0) {
     dbgs("input must be two non-empty vectors of k-bit values");
     exit(1);
   }
 
   int nElems = n / (2 * k + 2);
-  int *summedVec = new int[nElems * k];
-  int sharesVec[2*k];
   int split = n / 2;
-  for (int i = 0; i < nElems; i++) {
+
+  // each element is summed, tested against zero and masked by its flags on
+  // its own, so the elements can be built in parallel
+  buildElements(garbledCircuit, garblingContext, nElems,
+                [=](GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int i) {
+    int sharesVec[2*k];
+    int eqVec[2*k];
     memcpy(sharesVec, inputs + k*i, sizeof(int) * k);
     memcpy(sharesVec + k, inputs + split + k*i, sizeof(int) * k);
-    ADDCircuit(garbledCircuit, garblingContext, 2*k, sharesVec, summedVec + k*i);
-  }
+    ADDCircuit(garbledCircuit, garblingContext, 2*k, sharesVec, eqVec, shape);
 
-  int *xorSharedVec = new int[nElems];
-  for (int i = 0; i < nElems; i++) {
-    xorSharedVec[i] = getNextWire(garblingContext);
-    XORGate(garbledCircuit, garblingContext, inputs[nElems * k + i], inputs[split + nElems * k + i], xorSharedVec[i]);
-  }
+    int xorShared = getNextWire(garblingContext);
+    XORGate(garbledCircuit, garblingContext, inputs[nElems * k + i], inputs[split + nElems * k + i], xorShared);
 
-  int *threshVec = new int[nElems];
-  
-  int zeroWire = fixedZeroWire(garbledCircuit, garblingContext);
-  int eqVec[2*k];
-  for (int i = k; i < 2*k; i++) {
-    eqVec[i] = zeroWire;
-  }
-
-  for (int i = 0; i < nElems; i++) {
-    memcpy(eqVec, summedVec + k*i, sizeof(int) * k);
-    EQCircuit(garbledCircuit, garblingContext, 2*k, eqVec, threshVec + i);
-  }
+    int zeroWire = fixedZeroWire(garbledCircuit, garblingContext);
+    for (int j = k; j < 2*k; j++) {
+      eqVec[j] = zeroWire;
+    }
+    int thresh;
+    EQCircuit(garbledCircuit, garblingContext, 2*k, eqVec, &thresh, shape);
 
-  for (int i = 0; i < nElems; i++) {
     outputs[i] = getNextWire(garblingContext);
-    ANDGate(garbledCircuit, garblingContext, threshVec[i], xorSharedVec[i], outputs[i]);
+    ANDGate(garbledCircuit, garblingContext, thresh, xorShared, outputs[i]);
+  });
+}
+
+// Computes the max and the index of its first occurrence in an
+// additively-shared vector of k-bit values, as in ARGMAXIndexVecCircuit.
+void ARGMAXIndexVecSharedCircuit(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int k, int n, int *inputs, int *outputs, CircuitShape shape) {
+  if (n == 0 || n % 2 != 0 || n % (2 * k) != 0) {
+    dbgs("input must be two non-empty vectors of k-bit values");
+    exit(1);
   }
 
-  delete[] summedVec;
-  delete[] xorSharedVec;
-  delete[] threshVec;
+  ArenaScope scratch(garblingContext->arena);
+  int *summedVector = scratch.allocate<int>(n / 2);
+  addSharesCircuit(garbledCircuit, garblingContext, k, n, inputs, summedVector, shape);
+  ARGMAXIndexVecCircuit(garbledCircuit, garblingContext, k, n / 2, summedVector, outputs, shape);
 }
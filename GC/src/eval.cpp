@@ -25,83 +25,195 @@
 #include "include/dkcipher.h"
 #include "include/aes.h"
 #include "include/justGarble.h"
+#include "include/aesbatch.h"
+#include "include/threadpool.h"
 
 #include <malloc.h>
 #include <wmmintrin.h>
 
+// Evaluates the batchSize independent AND gates starting at firstGate,
+// encrypting the two hash inputs of every gate in a single call. Gate ids
+// start at gateBase, as in garbleANDBatch. The tables
+// of the batch are read from consecutive slots starting at garbledTable. As in
+// garbleANDBatch, the point-and-permute bits are applied as masks.
+static void evaluateANDBatch(GarbledCircuit *garbledCircuit, int firstGate, int batchSize,
+                             long gateBase, GarbledTable *garbledTable, DKCipherContext *dkCipherContext) {
+  block hashInputs[2 * EVAL_BATCH_SIZE];
+  block hashValues[GC_AES_BATCH_BLOCKS];
+  GarbledGate *garbledGates = garbledCircuit->garbledGates + firstGate;
+  block *labels = garbledCircuit->wireLabels;
+
+  for (int j = 0; j < batchSize; j++) {
+    long i = gateBase + firstGate + j;
+    GarbledGate *garbledGate = &(garbledGates[j]);
+
+    block tweak0 = makeBlock(2*i, (long) 0);
+    block tweak1 = makeBlock(2*i + 1, (long) 0);
+
+    hashInputs[2*j]     = xorBlocks(DOUBLE(labels[garbledGate->input0]), tweak0);
+    hashInputs[2*j + 1] = xorBlocks(DOUBLE(labels[garbledGate->input1]), tweak1);
+  }
+
+  memcpy(hashValues, hashInputs, 2 * batchSize * sizeof(block));
+  GC_AES_ecb_encrypt_blks_batch(hashValues, 2 * batchSize, &(dkCipherContext->K));
+
+  for (int j = 0; j < batchSize; j++) {
+    GarbledGate *garbledGate = &(garbledGates[j]);
+    block A = labels[garbledGate->input0];
+    block B = labels[garbledGate->input1];
+
+    block WG = xorBlocks(hashValues[2*j], hashInputs[2*j]);
+    WG = xorBlocks(WG, _mm_and_si128(garbledTable[j].table[0], getLSBMask(A)));
+
+    block WE = xorBlocks(hashValues[2*j + 1], hashInputs[2*j + 1]);
+    WE = xorBlocks(WE, _mm_and_si128(xorBlocks(garbledTable[j].table[1], A), getLSBMask(B)));
+
+    labels[garbledGate->output] = xorBlocks(WG, WE);
+  }
+}
+
+static void evaluateXORGates(GarbledCircuit *garbledCircuit, int begin, int end) {
+  block *labels = garbledCircuit->wireLabels;
+  for (int i = begin; i < end; i++) {
+    GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
+    labels[garbledGate->output] = xorBlocks(labels[garbledGate->input0], labels[garbledGate->input1]);
+  }
+}
+
+// The evaluator's label of the output of a NOT gate is that of its input;
+// only the garbler's meaning of the label changes.
+static void evaluateNOTGates(GarbledCircuit *garbledCircuit, int begin, int end) {
+  block *labels = garbledCircuit->wireLabels;
+  for (int i = begin; i < end; i++) {
+    GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
+    labels[garbledGate->output] = labels[garbledGate->input0];
+  }
+}
+
+// Evaluates the AND gates in [begin, end), whose tables are in tables.
+static void evaluateANDGates(GarbledCircuit *garbledCircuit, int begin, int end, long gateBase,
+                             GarbledTable *tables, DKCipherContext *dkCipherContext) {
+  for (int i = begin; i < end; i += EVAL_BATCH_SIZE) {
+    int batchSize = min(EVAL_BATCH_SIZE, end - i);
+    evaluateANDBatch(garbledCircuit, i, batchSize, gateBase, tables + (i - begin), dkCipherContext);
+  }
+}
+
 void evaluate(GarbledCircuit *garbledCircuit, ExtractedLabels extractedLabels,
               OutputMap outputMap) {
+  evaluate(garbledCircuit, extractedLabels, outputMap, TableSource());
+}
 
-  GarbledTable *garbledTable = garbledCircuit->garbledTable;
-  
-  // set input wires
-  for (int i = 0; i < garbledCircuit->n; i++) {
-    garbledCircuit->wires[i].label = extractedLabels[i];
-  }
+void evaluate(GarbledCircuit *garbledCircuit, ExtractedLabels extractedLabels,
+              OutputMap outputMap, const TableSource &tableSource) {
+  block *labels = getWireLabels(garbledCircuit, &(garbledCircuit->wireLabels));
 
-  // set fixed wires
   DKCipherContext fixedWireCipherContext;
   DKCipherInit(&(garbledCircuit->fixedWiresSeed), &fixedWireCipherContext);
 
+  DKCipherContext dkCipherContext;
+  DKCipherInit(&(garbledCircuit->globalKey), &dkCipherContext);
+
+  // resolve the AES backend before any worker thread needs it
+  GC_AES_get_backend();
+
+  // set input wires, through the replicated stage if there is one
+  long gateBase = 0, fixedBase = 0;
+  int tableIndex = 0;
+  ReplicatedStage *stage = garbledCircuit->stage;
+  if (stage != NULL) {
+    evaluateReplicatedStage(garbledCircuit, extractedLabels, &dkCipherContext, &fixedWireCipherContext,
+                            tableSource);
+    gateBase = (long) stage->nInstances * stage->instance.q;
+    fixedBase = (long) stage->nInstances * stage->instance.fixedWireIndices.size();
+    tableIndex = stage->nInstances * stage->instance.nAndGates;
+  } else {
+    for (int i = 0; i < garbledCircuit->n; i++) {
+      labels[garbledCircuit->inputWires[i]] = extractedLabels[i];
+    }
+  }
+
+  // set fixed wires
   block *fixedLabels = new block[garbledCircuit->fixedWireIndices.size()];
   for (uint32_t i = 0; i < garbledCircuit->fixedWireIndices.size(); i++) {
-    fixedLabels[i] = makeBlock((long) i, (long) 0);
+    fixedLabels[i] = makeBlock(fixedBase + i, (long) 0);
   }
   GC_AES_ecb_encrypt_blks(fixedLabels, garbledCircuit->fixedWireIndices.size(), &(fixedWireCipherContext.K));
   for (uint32_t i = 0; i < garbledCircuit->fixedWireIndices.size(); i++) {
     const pair<int, int> w = garbledCircuit->fixedWireIndices[i];
-    garbledCircuit->wires[w.first].label = fixedLabels[i];
+    labels[w.first] = fixedLabels[i];
   }
   delete[] fixedLabels;
 
-  // evaluate each gate of circuit
-  int tableIndex = 0;
-
-  DKCipherContext dkCipherContext;
-  DKCipherInit(&(garbledCircuit->globalKey), &dkCipherContext);
-
-  for (int i = 0; i < garbledCircuit->q; i++) {
-    GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
-
-    if (garbledGate->type == XORGATE) {
-      garbledCircuit->wires[garbledGate->output].label =
-            xorBlocks(garbledCircuit->wires[garbledGate->input0].label, 
-                      garbledCircuit->wires[garbledGate->input1].label);
-    } else {
-      int lsb0 = getLSB(garbledCircuit->wires[garbledGate->input0].label);
-      int lsb1 = getLSB(garbledCircuit->wires[garbledGate->input1].label);
-
-      block tweak0 = makeBlock((long) 2*i, (long) 0);
-      block tweak1 = makeBlock((long) 2*i + 1, (long) 0);
-
-      block hashInputs[2];    
-      hashInputs[0] = xorBlocks(DOUBLE(garbledCircuit->wires[garbledGate->input0].label), tweak0);
-      hashInputs[1] = xorBlocks(DOUBLE(garbledCircuit->wires[garbledGate->input1].label), tweak1);
+  // The tables are read from garbledTable, or with a source, into a window
+  // of TABLE_WINDOW_SIZE tables that is refilled whenever it is used up.
+  GarbledTable *window;
+  int nWindowTables, windowPos = 0;
+  if (tableSource) {
+    window = (GarbledTable*) memalign(128, sizeof(GarbledTable) * TABLE_WINDOW_SIZE);
+    nWindowTables = 0;
+    if (window == NULL) {
+      dbgs("Memory allocation error");
+      exit(1);
+    }
+  } else {
+    window = getGarbledTable(garbledCircuit) + tableIndex;
+    nWindowTables = garbledCircuit->nAndGates - tableIndex;
+  }
 
-      block hashValues[2];
-      memcpy(hashValues, hashInputs, sizeof(hashValues));
-      GC_AES_ecb_encrypt_blks(hashValues, 2, &(dkCipherContext.K));
-      for (int j = 0; j < 2; j++) {
-        hashValues[j] = xorBlocks(hashValues[j], hashInputs[j]);
+  // evaluate each gate of circuit
+  // Runs are processed as in garbleCircuit.
+  for (size_t k = 0; k < garbledCircuit->runs.size(); k++) {
+    int start = garbledCircuit->runs[k].start;
+    int count = garbledCircuit->runs[k].count;
+
+    if (garbledCircuit->runs[k].type == XORGATE) {
+      if (count < 2 * XOR_CHUNK_SIZE) {
+        evaluateXORGates(garbledCircuit, start, start + count);
+      } else {
+        parallelFor(count, XOR_CHUNK_SIZE, [=](int begin, int end) {
+          evaluateXORGates(garbledCircuit, start + begin, start + end);
+        });
       }
-
-      block WG = hashValues[0];
-      if (lsb0 == 1) {
-        WG = xorBlocks(WG, garbledTable[tableIndex].table[0]);
+    } else if (garbledCircuit->runs[k].type == NOTGATE) {
+      if (count < 2 * XOR_CHUNK_SIZE) {
+        evaluateNOTGates(garbledCircuit, start, start + count);
+      } else {
+        parallelFor(count, XOR_CHUNK_SIZE, [=](int begin, int end) {
+          evaluateNOTGates(garbledCircuit, start + begin, start + end);
+        });
       }
-
-      block WE = hashValues[1];
-      if (lsb1 == 1) {
-        WE = xorBlocks(WE, xorBlocks(garbledTable[tableIndex].table[1], garbledCircuit->wires[garbledGate->input0].label));     
+    } else {
+      // a run may be split across windows
+      for (int done = 0; done < count; ) {
+        if (windowPos == nWindowTables) {
+          nWindowTables = min(TABLE_WINDOW_SIZE, garbledCircuit->nAndGates - (tableIndex + done));
+          tableSource(window, nWindowTables);
+          windowPos = 0;
+        }
+        int first = start + done;
+        int piece = min(count - done, nWindowTables - windowPos);
+        GarbledTable *tables = window + windowPos;
+        if (piece < 2 * AND_CHUNK_SIZE) {
+          evaluateANDGates(garbledCircuit, first, first + piece, gateBase, tables, &dkCipherContext);
+        } else {
+          parallelFor(piece, AND_CHUNK_SIZE, [=, &dkCipherContext](int begin, int end) {
+            evaluateANDGates(garbledCircuit, first + begin, first + end, gateBase, tables + begin,
+                             &dkCipherContext);
+          });
+        }
+        done += piece;
+        windowPos += piece;
       }
-
-      garbledCircuit->wires[garbledGate->output].label = xorBlocks(WG, WE);
-
-      tableIndex++;
+      tableIndex += count;
     }
   }
 
+  if (tableSource) {
+    free(window);
+  }
+
   for (int i = 0; i < garbledCircuit->m; i++) {
-    outputMap[i] = garbledCircuit->wires[garbledCircuit->outputs[i]].label;
+    outputMap[i] = labels[garbledCircuit->outputs[i]];
   }
 }
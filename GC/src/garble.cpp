@@ -25,7 +25,11 @@
 #include "include/dkcipher.h"
 #include "include/aes.h"
 #include "include/justGarble.h"
+#include "include/arena.h"
+#include "include/aesbatch.h"
+#include "include/threadpool.h"
 #include <malloc.h>
+#include <sys/mman.h>
 #include <stdbool.h>
 #include <time.h>
 #include <wmmintrin.h>
@@ -100,23 +104,22 @@ void createEmptyGarbledCircuit(GarbledCircuit *garbledCircuit, int n, int m, int
   memset(garbledCircuit, 0, sizeof(GarbledCircuit));
   garbledCircuit->id = getNextId();
 
-  garbledCircuit->garbledGates = (GarbledGate*)  memalign(128, sizeof(GarbledGate) * q);
-  garbledCircuit->garbledTable = (GarbledTable*) memalign(128, sizeof(GarbledTable) * q);
-  garbledCircuit->wires = (Wire*) memalign(128, sizeof(Wire) * r);
+  if (q > 0) {
+    garbledCircuit->garbledGates = (GarbledGate*) memalign(128, sizeof(GarbledGate) * q);
+  }
   garbledCircuit->outputs = (int*) memalign(128, sizeof(int) * m);
+  garbledCircuit->inputWires = (int*) memalign(128, sizeof(int) * n);
 
-  if (garbledCircuit->garbledGates == NULL ||
-      garbledCircuit->garbledGates == NULL || 
-      garbledCircuit->wires        == NULL ||
-      garbledCircuit->outputs      == NULL) {
+  if ((garbledCircuit->garbledGates == NULL && q > 0) ||
+      garbledCircuit->outputs      == NULL ||
+      garbledCircuit->inputWires   == NULL) {
     dbgs("Memory allocation error");
     exit(1);
   }
 
-  memset(garbledCircuit->garbledGates, 0, sizeof(GarbledGate) * q);
-  memset(garbledCircuit->garbledTable, 0, sizeof(GarbledTable) * q);
-  memset(garbledCircuit->wires, 0, sizeof(Wire) * r);
-  memset(garbledCircuit->outputs, 0, sizeof(int) * m);
+  for (int i = 0; i < n; i++) {
+    garbledCircuit->inputWires[i] = i;
+  }
 
   garbledCircuit->m = m;
   garbledCircuit->n = n;
@@ -124,32 +127,167 @@ void createEmptyGarbledCircuit(GarbledCircuit *garbledCircuit, int n, int m, int
   garbledCircuit->r = r;
 }
 
+// Returns the wire label array at *labels, allocating it if needed.
+block *getWireLabels(GarbledCircuit *garbledCircuit, block **labels) {
+  if (*labels == NULL) {
+    *labels = (block*) memalign(128, sizeof(block) * garbledCircuit->r);
+    if (*labels == NULL) {
+      dbgs("Memory allocation error");
+      exit(1);
+    }
+  }
+  return *labels;
+}
+
+// Returns the table array of a circuit, allocating a table for every AND
+// gate if needed. Garbling into a sink and evaluating from a source never
+// need it.
+GarbledTable *getGarbledTable(GarbledCircuit *garbledCircuit) {
+  if (garbledCircuit->garbledTable == NULL) {
+    garbledCircuit->garbledTable = (GarbledTable*) memalign(128, sizeof(GarbledTable) * garbledCircuit->nAndGates);
+    if (garbledCircuit->garbledTable == NULL && garbledCircuit->nAndGates > 0) {
+      dbgs("Memory allocation error");
+      exit(1);
+    }
+  }
+  return garbledCircuit->garbledTable;
+}
+
 void removeGarbledCircuit(GarbledCircuit *garbledCircuit) {
-  free(garbledCircuit->wires);
-  free(garbledCircuit->garbledGates);
-  free(garbledCircuit->outputs);
+  free(garbledCircuit->wireLabels0);
+  free(garbledCircuit->wireLabels);
+  if (!garbledCircuit->mapped) {
+    free(garbledCircuit->garbledGates);
+    free(garbledCircuit->outputs);
+    free(garbledCircuit->inputWires);
+  }
   free(garbledCircuit->garbledTable);
+
+  if (garbledCircuit->stage != NULL) {
+    ReplicatedStage *stage = garbledCircuit->stage;
+    removeGarbledCircuit(&(stage->instance));
+    delete[] stage->inputOffsets;
+    delete[] stage->inputStrides;
+    delete[] stage->outputOffsets;
+    delete[] stage->outputStrides;
+    delete stage;
+    garbledCircuit->stage = NULL;
+  }
+
+  if (garbledCircuit->mapping != NULL) {
+    munmap(garbledCircuit->mapping, garbledCircuit->mappingSize);
+    garbledCircuit->mapping = NULL;
+  }
 }
 
 void startBuilding(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext) {
   memset(garblingContext, 0, sizeof(GarblingContext));
   garblingContext->wireIndex = garbledCircuit->n;
+  garblingContext->arena = getBuildArena();
+}
+
+void startDryRun(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext) {
+  startBuilding(garbledCircuit, garblingContext);
+  garblingContext->dryRun = true;
+}
+
+void finishDryRun(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext) {
+  garbledCircuit->q = garblingContext->gateIndex;
+  garbledCircuit->r = garblingContext->wireIndex;
+
+  free(garbledCircuit->garbledGates);
+  garbledCircuit->garbledGates = NULL;
+  if (garbledCircuit->q > 0) {
+    garbledCircuit->garbledGates = (GarbledGate*) memalign(128, sizeof(GarbledGate) * garbledCircuit->q);
+    if (garbledCircuit->garbledGates == NULL) {
+      dbgs("Memory allocation error");
+      exit(1);
+    }
+  }
+  garbledCircuit->fixedWireIndices.reserve(garbledCircuit->fixedWireIndices.size() + garblingContext->nFixedWires);
+}
+
+void buildElements(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int nElems,
+                   const function<void(GarbledCircuit*, GarblingContext*, int)> &buildElement) {
+  if (garblingContext->dryRun || garblingContext->stream != NULL || nElems < 2 * BUILD_CHUNK_SIZE) {
+    for (int e = 0; e < nElems; e++) {
+      buildElement(garbledCircuit, garblingContext, e);
+    }
+    return;
+  }
+
+  // count what the first element adds
+  GarblingContext counter = *garblingContext;
+  counter.dryRun = true;
+  buildElement(garbledCircuit, &counter, 0);
+  long nWires = counter.wireIndex - garblingContext->wireIndex;
+  long nGates = counter.gateIndex - garblingContext->gateIndex;
+  long nTables = counter.tableIndex - garblingContext->tableIndex;
+  long nFixedWires = counter.nFixedWires - garblingContext->nFixedWires;
+
+  // set the space aside, so that nothing is reallocated while the ranges
+  // are built
+  reserveGates(garbledCircuit, garblingContext, nGates * nElems);
+  vector<pair<int, int>> &fixedWires = garbledCircuit->fixedWireIndices;
+  fixedWires.resize(max((long) fixedWires.size(), garblingContext->nFixedWires + nFixedWires * nElems));
+
+  const GarblingContext start = *garblingContext;
+  parallelFor(nElems, BUILD_CHUNK_SIZE, [&](int begin, int end) {
+    GarblingContext context = start;
+    context.wireIndex += nWires * begin;
+    context.gateIndex += nGates * begin;
+    context.tableIndex += nTables * begin;
+    context.nFixedWires += nFixedWires * begin;
+    context.arena = getBuildArena();
+    for (int e = begin; e < end; e++) {
+      buildElement(garbledCircuit, &context, e);
+    }
+    if (context.wireIndex != start.wireIndex + nWires * end ||
+        context.gateIndex != start.gateIndex + nGates * end ||
+        context.nFixedWires != start.nFixedWires + nFixedWires * end) {
+      dbgs("elements passed to buildElements must all have the same size");
+      exit(1);
+    }
+  });
+
+  garblingContext->wireIndex += nWires * nElems;
+  garblingContext->gateIndex += nGates * nElems;
+  garblingContext->tableIndex += nTables * nElems;
+  garblingContext->nFixedWires += nFixedWires * nElems;
 }
 
 void finishBuilding(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int *outputs) {
   garbledCircuit->q = garblingContext->gateIndex;
   garbledCircuit->r = garblingContext->wireIndex;
   memcpy(garbledCircuit->outputs, outputs, garbledCircuit->m * sizeof(int));
+  optimizeCircuit(garbledCircuit);
+  scheduleCircuit(garbledCircuit, SCHEDULE_WINDOW);
+  renumberWires(garbledCircuit);
+  assignWireSlots(garbledCircuit);
+
+  garbledCircuit->nAndGates = 0;
+  for (int i = 0; i < garbledCircuit->q; i++) {
+    if (garbledCircuit->garbledGates[i].type == ANDGATE) {
+      garbledCircuit->nAndGates++;
+    }
+  }
+
+  free(garbledCircuit->garbledTable);
+  garbledCircuit->garbledTable = NULL;
 }
 
+// The labels come from createInputLabels, so every 1-label is the 0-label
+// XOR the same offset R and only the 0-labels need to be read.
 void extractLabels(ExtractedLabels extractedLabels, InputLabels inputLabels,
                    uint8_t *inputBits, int n) {
+  if (n == 0) {
+    return;
+  }
+
+  block R = xorBlocks(inputLabels[0], inputLabels[1]);
   for (int i = 0; i < n; i++) {
-    if (inputBits[i]) {
-      extractedLabels[i] = inputLabels[2 * i + 1];
-    } else {
-      extractedLabels[i] = inputLabels[2 * i];
-    }
+    block mask = _mm_set1_epi64x(-(long) (inputBits[i] & 1));
+    extractedLabels[i] = xorBlocks(inputLabels[2 * i], _mm_and_si128(R, mask));
   }
 }
 
@@ -171,25 +309,253 @@ void createInputLabels(InputLabels inputLabels, int n, block R) {
   }
 }
 
+void createInputLabelSource(InputLabelSource *source, block *storedLabels, int nStored, block R) {
+  seedRandom();
+  source->R = R;
+  source->storedLabels = storedLabels;
+  source->nStored = nStored;
+  source->stride = 1;
+  source->progress = NULL;
+
+  block seed = randomBlock();
+  DKCipherInit(&seed, &(source->seedCipherContext));
+}
+
+void InputLabelProgress::publish(long n) {
+  {
+    lock_guard<mutex> guard(lock);
+    nReady = n;
+  }
+  published.notify_all();
+}
+
+void InputLabelProgress::waitFor(long n) {
+  if (nReady >= n) {
+    return;
+  }
+  unique_lock<mutex> guard(lock);
+  published.wait(guard, [&] { return nReady >= n; });
+}
+
+void getInputLabels(InputLabelSource *source, const long *inputs, int count, block *labels) {
+  block derived[GC_AES_BATCH_BLOCKS];
+  int positions[GC_AES_BATCH_BLOCKS];
+  int nDerived = 0;
+
+  if (source->progress != NULL) {
+    long lastStored = -1;
+    for (int i = 0; i < count; i++) {
+      if (inputs[i] < source->nStored) {
+        lastStored = max(lastStored, inputs[i]);
+      }
+    }
+    source->progress->waitFor(lastStored + 1);
+  }
+
+  for (int i = 0; i < count; i++) {
+    long input = inputs[i];
+    if (input < source->nStored) {
+      labels[i] = source->storedLabels[input * source->stride];
+      continue;
+    }
+
+    derived[nDerived] = makeBlock(input, (long) 0);
+    positions[nDerived++] = i;
+    if (nDerived == GC_AES_BATCH_BLOCKS) {
+      GC_AES_ecb_encrypt_blks_batch(derived, nDerived, &(source->seedCipherContext.K));
+      for (int j = 0; j < nDerived; j++) {
+        labels[positions[j]] = derived[j];
+      }
+      nDerived = 0;
+    }
+  }
+
+  if (nDerived > 0) {
+    GC_AES_ecb_encrypt_blks_batch(derived, nDerived, &(source->seedCipherContext.K));
+    for (int j = 0; j < nDerived; j++) {
+      labels[positions[j]] = derived[j];
+    }
+  }
+}
+
+// Calls f(i, label) with the 0-label of every input i in [begin, end),
+// deriving the labels a batch at a time.
+template <typename F>
+static void forEachInputLabel(InputLabelSource *source, long begin, long end, F f) {
+  const int batch = 256;
+  long inputs[batch];
+  block labels[batch];
+
+  for (long i = begin; i < end; i += batch) {
+    int count = (int) min((long) batch, end - i);
+    for (int j = 0; j < count; j++) {
+      inputs[j] = i + j;
+    }
+    getInputLabels(source, inputs, count, labels);
+    for (int j = 0; j < count; j++) {
+      f(i + j, labels[j]);
+    }
+  }
+}
+
+void extractLabels(ExtractedLabels extractedLabels, InputLabelSource *source,
+                   uint8_t *inputBits, long begin, int n) {
+  block R = source->R;
+  forEachInputLabel(source, begin, begin + n, [&](long i, block label) {
+    block mask = _mm_set1_epi64x(-(long) (inputBits[i - begin] & 1));
+    extractedLabels[i - begin] = xorBlocks(label, _mm_and_si128(R, mask));
+  });
+}
+
+// Garbles the batchSize independent AND gates starting at firstGate using
+// half-gates. The four hash inputs of every gate in the batch are encrypted
+// in a single call so that the AES rounds of different gates are interleaved
+// in the pipeline. Gate i is hashed with the tweaks of gate id gateBase + i,
+// and the tables for the batch are written to consecutive slots starting at
+// garbledTable. The point-and-permute bits select blocks through
+// masks rather than branches, since they are random and would mispredict
+// half of the time.
+static void garbleANDBatch(GarbledCircuit *garbledCircuit, int firstGate, int batchSize,
+                           long gateBase, GarbledTable *garbledTable, block R, DKCipherContext *dkCipherContext) {
+  block hashInputs[4 * GARBLE_BATCH_SIZE];
+  block hashValues[GC_AES_BATCH_BLOCKS];
+  GarbledGate *garbledGates = garbledCircuit->garbledGates + firstGate;
+  block *labels0 = garbledCircuit->wireLabels0;
+  // DOUBLE is linear, so the hash inputs of the 1-labels are those of the
+  // 0-labels XOR DOUBLE(R).
+  block doubleR = DOUBLE(R);
+
+  for (int j = 0; j < batchSize; j++) {
+    long i = gateBase + firstGate + j;
+    GarbledGate *garbledGate = &(garbledGates[j]);
+
+    block tweak0 = makeBlock(2*i, (long) 0);
+    block tweak1 = makeBlock(2*i + 1, (long) 0);
+
+    hashInputs[4*j]     = xorBlocks(DOUBLE(labels0[garbledGate->input0]), tweak0);
+    hashInputs[4*j + 1] = xorBlocks(hashInputs[4*j], doubleR);
+    hashInputs[4*j + 2] = xorBlocks(DOUBLE(labels0[garbledGate->input1]), tweak1);
+    hashInputs[4*j + 3] = xorBlocks(hashInputs[4*j + 2], doubleR);
+  }
+
+  memcpy(hashValues, hashInputs, 4 * batchSize * sizeof(block));
+  GC_AES_ecb_encrypt_blks_batch(hashValues, 4 * batchSize, &(dkCipherContext->K));
+
+  for (int j = 0; j < batchSize; j++) {
+    GarbledGate *garbledGate = &(garbledGates[j]);
+    block *h = hashValues + 4*j;
+    for (int k = 0; k < 4; k++) {
+      h[k] = xorBlocks(h[k], hashInputs[4*j + k]);
+    }
+
+    block A0 = labels0[garbledGate->input0];
+    block mask0 = getLSBMask(A0);
+    block mask1 = getLSBMask(labels0[garbledGate->input1]);
+
+    // first half gate
+    block TG = xorBlocks(xorBlocks(h[0], h[1]), _mm_and_si128(R, mask1));
+    block WG = xorBlocks(h[0], _mm_and_si128(TG, mask0));
+
+    // second half gate
+    block TE = xorBlocks(h[2], h[3]);
+    block WE = xorBlocks(h[2], _mm_and_si128(TE, mask1));
+    TE = xorBlocks(TE, A0);
+
+    labels0[garbledGate->output] = xorBlocks(WG, WE);
+
+    garbledTable[j].table[0] = TG;
+    garbledTable[j].table[1] = TE;
+  }
+}
+
+static void garbleXORGates(GarbledCircuit *garbledCircuit, int begin, int end) {
+  block *labels0 = garbledCircuit->wireLabels0;
+  for (int i = begin; i < end; i++) {
+    GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
+    labels0[garbledGate->output] = xorBlocks(labels0[garbledGate->input0], labels0[garbledGate->input1]);
+  }
+}
+
+// NOT gates are free: the 0-label of the output is the 1-label of the input.
+static void garbleNOTGates(GarbledCircuit *garbledCircuit, int begin, int end, block R) {
+  block *labels0 = garbledCircuit->wireLabels0;
+  for (int i = begin; i < end; i++) {
+    GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
+    labels0[garbledGate->output] = xorBlocks(labels0[garbledGate->input0], R);
+  }
+}
+
+// Garbles the AND gates in [begin, end), writing their tables to tables.
+static void garbleANDGates(GarbledCircuit *garbledCircuit, int begin, int end, long gateBase,
+                           GarbledTable *tables, block R, DKCipherContext *dkCipherContext) {
+  for (int i = begin; i < end; i += GARBLE_BATCH_SIZE) {
+    int batchSize = min(GARBLE_BATCH_SIZE, end - i);
+    garbleANDBatch(garbledCircuit, i, batchSize, gateBase, tables + (i - begin), R, dkCipherContext);
+  }
+}
+
 void garbleCircuit(GarbledCircuit *garbledCircuit, InputLabels inputLabels, OutputMap outputMap) {
+  InputLabelSource source;
+  if (garbledCircuit->n > 0) {
+    source.R = xorBlocks(inputLabels[0], inputLabels[1]);
+  } else {
+    // without input labels to take it from, pick R as createInputLabels does
+    seedRandom();
+    source.R = randomBlock() | makeBlock((uint64_t) 0, (uint64_t) 1);
+  }
+  source.storedLabels = inputLabels;
+  source.nStored = garbledCircuit->n;
+  source.stride = 2;
+  source.progress = NULL;
+
+  garbleCircuit(garbledCircuit, &source, outputMap);
+}
+
+void garbleCircuit(GarbledCircuit *garbledCircuit, InputLabelSource *source, OutputMap outputMap) {
+  garbleCircuit(garbledCircuit, source, outputMap, TableSink());
+}
+
+void garbleCircuit(GarbledCircuit *garbledCircuit, InputLabelSource *source, OutputMap outputMap,
+                   const TableSink &sink) {
   seedRandom();
   garbledCircuit->id = getFreshId();
 
-  for(int i = 0; i < 2*garbledCircuit->n; i += 2) {
-    garbledCircuit->wires[i/2].id = i / 2;
-    garbledCircuit->wires[i/2].label0 = inputLabels[i];
-    garbledCircuit->wires[i/2].label1 = inputLabels[i+1];
-  }
-  block R = xorBlocks(garbledCircuit->wires[0].label0, garbledCircuit->wires[0].label1);
+  block *labels0 = getWireLabels(garbledCircuit, &(garbledCircuit->wireLabels0));
+  block R = source->R;
+  garbledCircuit->R = R;
 
   // initialize fixed wires from a PRG (built from AES)
   garbledCircuit->fixedWiresSeed = randomBlock();
   DKCipherContext fixedWireCipherContext;
   DKCipherInit(&(garbledCircuit->fixedWiresSeed), &fixedWireCipherContext);
 
+  garbledCircuit->globalKey = randomBlock();
+  DKCipherContext dkCipherContext;
+  DKCipherInit(&(garbledCircuit->globalKey), &dkCipherContext);
+
+  // resolve the AES backend before any worker thread needs it
+  GC_AES_get_backend();
+
+  // The gates after a replicated stage continue its gate ids, tables and
+  // fixed labels (see replicate.cpp).
+  long gateBase = 0, fixedBase = 0;
+  int tableIndex = 0;
+  ReplicatedStage *stage = garbledCircuit->stage;
+  if (stage != NULL) {
+    garbleReplicatedStage(garbledCircuit, source, &dkCipherContext, &fixedWireCipherContext, sink);
+    gateBase = (long) stage->nInstances * stage->instance.q;
+    fixedBase = (long) stage->nInstances * stage->instance.fixedWireIndices.size();
+    tableIndex = stage->nInstances * stage->instance.nAndGates;
+  } else {
+    int *inputWires = garbledCircuit->inputWires;
+    forEachInputLabel(source, 0, garbledCircuit->n, [=](long i, block label) {
+      labels0[inputWires[i]] = label;
+    });
+  }
+
   block *fixedLabels = new block[garbledCircuit->fixedWireIndices.size()];
   for (uint32_t i = 0; i < garbledCircuit->fixedWireIndices.size(); i++) {
-    fixedLabels[i] = makeBlock((long) i, (long) 0);
+    fixedLabels[i] = makeBlock(fixedBase + i, (long) 0);
   }
   GC_AES_ecb_encrypt_blks(fixedLabels, garbledCircuit->fixedWireIndices.size(), &(fixedWireCipherContext.K));
 
@@ -197,94 +563,95 @@ void garbleCircuit(GarbledCircuit *garbledCircuit, InputLabels inputLabels, Outp
     const pair<int, int> w = garbledCircuit->fixedWireIndices[i];
 
     if (w.second == FIXED_ZERO_GATE) {
-      garbledCircuit->wires[w.first].label0 = fixedLabels[i];
-      garbledCircuit->wires[w.first].label1 = xorBlocks(fixedLabels[i], R);
+      labels0[w.first] = fixedLabels[i];
     } else if (w.second == FIXED_ONE_GATE) {
-      garbledCircuit->wires[w.first].label1 = fixedLabels[i];
-      garbledCircuit->wires[w.first].label0 = xorBlocks(fixedLabels[i], R);
+      labels0[w.first] = xorBlocks(fixedLabels[i], R);
     }
   }
   delete[] fixedLabels;
 
-  // garble each gate of circuit
-  garbledCircuit->globalKey = randomBlock();
-  GarbledTable *garbledTable = garbledCircuit->garbledTable;
-
-  DKCipherContext dkCipherContext;
-  DKCipherInit(&(garbledCircuit->globalKey), &dkCipherContext);
-  int tableIndex = 0;
-
-  for(int i = 0; i < garbledCircuit->q; i++) {
-    GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
-
-    int input0 = garbledGate->input0;
-    int input1 = garbledGate->input1;
-    int output = garbledGate->output;
-
-    if (garbledGate->type == XORGATE) {
-      garbledCircuit->wires[output].label0 = xorBlocks(garbledCircuit->wires[input0].label0, garbledCircuit->wires[input1].label0);
-      garbledCircuit->wires[output].label1 = xorBlocks(garbledCircuit->wires[input0].label1, garbledCircuit->wires[input1].label0);
-      continue;
-    } else if (garbledGate->type != ANDGATE) {
-      dbgs("currently only support AND and XOR gates");
+  // The tables go to garbledTable, or with a sink, to a window of
+  // TABLE_WINDOW_SIZE tables that is handed over whenever it is full.
+  GarbledTable *window;
+  int windowSize, nWindowTables = 0;
+  if (sink) {
+    window = (GarbledTable*) memalign(128, sizeof(GarbledTable) * TABLE_WINDOW_SIZE);
+    windowSize = TABLE_WINDOW_SIZE;
+    if (window == NULL) {
+      dbgs("Memory allocation error");
       exit(1);
     }
+  } else {
+    window = getGarbledTable(garbledCircuit) + tableIndex;
+    windowSize = garbledCircuit->nAndGates - tableIndex;
+  }
 
-    int lsb0 = getLSB(garbledCircuit->wires[input0].label0);
-    int lsb1 = getLSB(garbledCircuit->wires[input1].label0);
-
-    block tweak0 = makeBlock((long) 2*i, (long) 0);
-    block tweak1 = makeBlock((long) 2*i + 1, (long) 0);
-
-    block hashInputs[4];
-    hashInputs[0] = xorBlocks(DOUBLE(garbledCircuit->wires[input0].label0), tweak0);
-    hashInputs[1] = xorBlocks(DOUBLE(garbledCircuit->wires[input0].label1), tweak0);
-
-    hashInputs[2] = xorBlocks(DOUBLE(garbledCircuit->wires[input1].label0), tweak1);
-    hashInputs[3] = xorBlocks(DOUBLE(garbledCircuit->wires[input1].label1), tweak1);
-
-    block hashValues[4];
-    memcpy(hashValues, hashInputs, sizeof(hashValues));
-    GC_AES_ecb_encrypt_blks(hashValues, 4, &(dkCipherContext.K));
-    for (int j = 0; j < 4; j++) {
-      hashValues[j] = xorBlocks(hashValues[j], hashInputs[j]);
-    }
-
-    // first half gate
-    block WG = hashValues[0];
-    block TG = xorBlocks(hashValues[0], hashValues[1]);
-    if (lsb1 == 1) {
-      TG = xorBlocks(TG, R);
-    }
-    if (lsb0 == 1) {  
-      WG = xorBlocks(WG, TG);
-    }
-
-    // second half gate
-    block WE = hashValues[2];
-    block TE = xorBlocks(hashValues[2], hashValues[3]);
-    if (lsb1 == 1) {
-      WE = xorBlocks(WE, TE);
+  // garble each gate of circuit
+  // Gates are processed one run at a time (see scheduleCircuit). The gates
+  // of a run are independent, so AND gates are garbled GARBLE_BATCH_SIZE at
+  // a time without any dependency checks, and large runs are split across
+  // the thread pool. Every AND gate has a fixed table index (its position
+  // among the AND gates of the schedule), whichever thread garbles it.
+  for (size_t k = 0; k < garbledCircuit->runs.size(); k++) {
+    int start = garbledCircuit->runs[k].start;
+    int count = garbledCircuit->runs[k].count;
+
+    if (garbledCircuit->runs[k].type == XORGATE) {
+      if (count < 2 * XOR_CHUNK_SIZE) {
+        garbleXORGates(garbledCircuit, start, start + count);
+      } else {
+        parallelFor(count, XOR_CHUNK_SIZE, [=](int begin, int end) {
+          garbleXORGates(garbledCircuit, start + begin, start + end);
+        });
+      }
+    } else if (garbledCircuit->runs[k].type == NOTGATE) {
+      if (count < 2 * XOR_CHUNK_SIZE) {
+        garbleNOTGates(garbledCircuit, start, start + count, R);
+      } else {
+        parallelFor(count, XOR_CHUNK_SIZE, [=](int begin, int end) {
+          garbleNOTGates(garbledCircuit, start + begin, start + end, R);
+        });
+      }
+    } else if (garbledCircuit->runs[k].type == ANDGATE) {
+      // a run may be split across windows
+      for (int done = 0; done < count; ) {
+        int first = start + done;
+        int piece = min(count - done, windowSize - nWindowTables);
+        GarbledTable *tables = window + nWindowTables;
+        if (piece < 2 * AND_CHUNK_SIZE) {
+          garbleANDGates(garbledCircuit, first, first + piece, gateBase, tables, R, &dkCipherContext);
+        } else {
+          parallelFor(piece, AND_CHUNK_SIZE, [=, &dkCipherContext](int begin, int end) {
+            garbleANDGates(garbledCircuit, first + begin, first + end, gateBase, tables + begin, R,
+                           &dkCipherContext);
+          });
+        }
+        done += piece;
+        nWindowTables += piece;
+        if (sink && nWindowTables == windowSize) {
+          sink(window, nWindowTables);
+          nWindowTables = 0;
+        }
+      }
+      tableIndex += count;
+    } else {
+      dbgs("currently only support AND, XOR and NOT gates");
+      exit(1);
     }
-    TE = xorBlocks(TE, garbledCircuit->wires[input0].label0);
-
-    block newToken = xorBlocks(WG, WE);
-
-    garbledCircuit->wires[garbledGate->output].label0 = newToken;
-    garbledCircuit->wires[garbledGate->output].label1 = xorBlocks(R, newToken);
-
-    garbledTable[tableIndex].table[0] = TG;
-    garbledTable[tableIndex].table[1] = TE;
-
-    tableIndex++;
   }
 
   for(int i = 0; i < garbledCircuit->m; i++) {
-    outputMap[2*i]   = garbledCircuit->wires[garbledCircuit->outputs[i]].label0;
-    outputMap[2*i+1] = garbledCircuit->wires[garbledCircuit->outputs[i]].label1;
+    outputMap[2*i]   = labels0[garbledCircuit->outputs[i]];
+    outputMap[2*i+1] = xorBlocks(labels0[garbledCircuit->outputs[i]], R);
   }
 
   garbledCircuit->nAndGates = tableIndex;
+  if (sink) {
+    if (nWindowTables > 0) {
+      sink(window, nWindowTables);
+    }
+    free(window);
+  }
 }
 
 int blockEqual(block a, block b) {
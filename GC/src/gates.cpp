@@ -22,22 +22,54 @@
 #include "include/common.h"
 #include "include/gates.h"
 #include "include/justGarble.h"
+#include "include/stream.h"
+
+#include <algorithm>
+#include <malloc.h>
+
+void reserveGates(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, long nGates) {
+  if (garblingContext->gateIndex + nGates > garbledCircuit->q) {
+    long capacity = max(2L * garbledCircuit->q, max(garblingContext->gateIndex + nGates, 1024L));
+    GarbledGate *garbledGates = (GarbledGate*) memalign(128, sizeof(GarbledGate) * capacity);
+    if (garbledGates == NULL) {
+      dbgs("Memory allocation error");
+      exit(1);
+    }
+    if (garblingContext->gateIndex > 0) {
+      memcpy(garbledGates, garbledCircuit->garbledGates, sizeof(GarbledGate) * garblingContext->gateIndex);
+    }
+    free(garbledCircuit->garbledGates);
+    garbledCircuit->garbledGates = garbledGates;
+    garbledCircuit->q = capacity;
+  }
+}
 
-static int genericGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int input0, int input1, int output, int type) {
-  garbledCircuit->wires[output].id = output;
+static GarbledGate *nextGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext) {
+  reserveGates(garbledCircuit, garblingContext, 1);
+  return &(garbledCircuit->garbledGates[garblingContext->gateIndex]);
+}
 
-  GarbledGate *garbledGate = &(garbledCircuit->garbledGates[garblingContext->gateIndex]);
+static int genericGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int input0, int input1, int output, int type) {
+  if (garblingContext->dryRun) {
+    garblingContext->tableIndex++;
+    return garblingContext->gateIndex++;
+  }
+  if (garblingContext->stream != NULL) {
+    garblingContext->stream->addGate(type, input0, input1, output);
+    garblingContext->tableIndex++;
+    return garblingContext->gateIndex++;
+  }
+
+  GarbledGate *garbledGate = nextGate(garbledCircuit, garblingContext);
 
-  garbledGate->id = garblingContext->gateIndex;
   garbledGate->type = type;
   garbledGate->input0 = input0;
   garbledGate->input1 = input1;
   garbledGate->output = output;
 
-  garblingContext->gateIndex++;
   garblingContext->tableIndex++;
 
-  return garbledGate->id;
+  return garblingContext->gateIndex++;
 }
 
 int ANDGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int input0, int input1, int output) {
@@ -49,16 +81,23 @@ int ORGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int
 }
 
 int NOTGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int input, int output) {
-  return genericGate(garbledCircuit, garblingContext, 0, input, output, NOTGATE);
+  return genericGate(garbledCircuit, garblingContext, input, input, output, NOTGATE);
 }
 
 int XORGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext,
             int input0, int input1, int output) {
-  garbledCircuit->wires[output].id = output;
-
-  GarbledGate *garbledGate = &(garbledCircuit->garbledGates[garblingContext->gateIndex]);
+  if (garblingContext->dryRun) {
+    garblingContext->gateIndex++;
+    return 0;
+  }
+  if (garblingContext->stream != NULL) {
+    garblingContext->stream->addGate(XORGATE, input0, input1, output);
+    garblingContext->gateIndex++;
+    return 0;
+  }
+
+  GarbledGate *garbledGate = nextGate(garbledCircuit, garblingContext);
 
-  garbledGate->id = XOR_ID;
   garbledGate->type = XORGATE;
   
   garbledGate->input0 = input0;
@@ -73,8 +112,19 @@ int XORGate(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext,
 static int fixedWire(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, int id) {
   int ind = getNextWire(garblingContext);
 
-  garbledCircuit->fixedWireIndices.push_back(pair<int, int>(ind, id));
-  garbledCircuit->wires[ind].id = ind;
+  // The fixed wires of a range built by buildElements go into slots that
+  // were set aside for them.
+  if (garblingContext->stream != NULL) {
+    garblingContext->stream->addFixedWire(ind, id);
+  } else if (!garblingContext->dryRun) {
+    vector<pair<int, int>> &fixedWires = garbledCircuit->fixedWireIndices;
+    if (garblingContext->nFixedWires < (long) fixedWires.size()) {
+      fixedWires[garblingContext->nFixedWires] = pair<int, int>(ind, id);
+    } else {
+      fixedWires.push_back(pair<int, int>(ind, id));
+    }
+  }
+  garblingContext->nFixedWires++;
 
   return ind;
 }
@@ -0,0 +1,297 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "include/garble.h"
+#include "include/justGarble.h"
+
+#include <malloc.h>
+
+// During optimization every wire of the original circuit is mapped to a
+// literal, which is either a constant or a wire of the optimized circuit,
+// possibly negated. A literal is 2 * wire + negated, and the constants are
+// FALSE_LITERAL and TRUE_LITERAL, so that XORing a literal with 1 always
+// negates it.
+#define FALSE_LITERAL -2
+#define TRUE_LITERAL -1
+
+static inline bool isConstant(int literal) { return literal < 0; }
+static inline int literalWire(int literal) { return literal >> 1; }
+static inline int isNegated(int literal) { return literal & 1; }
+
+namespace {
+
+// A gate of the optimized circuit. Empty slots of a GateTable have type -1.
+struct GateKey {
+  int type;
+  uint32_t input0, input1;
+
+  bool operator==(const GateKey &other) const {
+    return type == other.type && input0 == other.input0 && input1 == other.input1;
+  }
+};
+
+const GateKey EMPTY_KEY = {-1, 0, 0};
+
+// Open-addressing table from (type, input0, input1) to the output of the
+// gate of the optimized circuit that computes it.
+class GateTable {
+ public:
+  explicit GateTable(int expectedGates) {
+    size_t capacity = 16;
+    while (capacity < 2 * (size_t) expectedGates) {
+      capacity *= 2;
+    }
+    keys.assign(capacity, EMPTY_KEY);
+    values.resize(capacity);
+    mask = capacity - 1;
+    size = 0;
+  }
+
+  // Returns the output for the key if there is one, and otherwise stores
+  // output for it and returns -1.
+  int findOrInsert(int type, uint32_t input0, uint32_t input1, int output) {
+    GateKey key = {type, input0, input1};
+    size_t i = hash(key) & mask;
+    while (keys[i].type != EMPTY_KEY.type) {
+      if (keys[i] == key) {
+        return values[i];
+      }
+      i = (i + 1) & mask;
+    }
+
+    keys[i] = key;
+    values[i] = output;
+    if (++size * 2 > keys.size()) {
+      grow();
+    }
+    return -1;
+  }
+
+ private:
+  static size_t hash(const GateKey &key) {
+    uint64_t h = (((uint64_t) key.input0 << 32) | key.input1) ^ ((uint64_t) key.type * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  void grow() {
+    vector<GateKey> oldKeys;
+    vector<int> oldValues;
+    oldKeys.swap(keys);
+    oldValues.swap(values);
+
+    keys.assign(oldKeys.size() * 2, EMPTY_KEY);
+    values.resize(oldKeys.size() * 2);
+    mask = keys.size() - 1;
+    for (size_t j = 0; j < oldKeys.size(); j++) {
+      if (oldKeys[j].type != EMPTY_KEY.type) {
+        size_t i = hash(oldKeys[j]) & mask;
+        while (keys[i].type != EMPTY_KEY.type) {
+          i = (i + 1) & mask;
+        }
+        keys[i] = oldKeys[j];
+        values[i] = oldValues[j];
+      }
+    }
+  }
+
+  vector<GateKey> keys;
+  vector<int> values;
+  size_t mask, size;
+};
+
+class Optimizer {
+ public:
+  Optimizer(GarbledCircuit *garbledCircuit)
+      : garbledCircuit(garbledCircuit), table(garbledCircuit->q), nextWire(garbledCircuit->r),
+        constantWires{-1, -1} {
+    gates.reserve(garbledCircuit->q);
+  }
+
+  void run() {
+    int r = garbledCircuit->r;
+    vector<int> literals(r);
+    for (int i = 0; i < r; i++) {
+      literals[i] = 2 * i;
+    }
+    for (uint32_t i = 0; i < garbledCircuit->fixedWireIndices.size(); i++) {
+      const pair<int, int> &w = garbledCircuit->fixedWireIndices[i];
+      literals[w.first] = (w.second == FIXED_ONE_GATE) ? TRUE_LITERAL : FALSE_LITERAL;
+    }
+
+    for (int i = 0; i < garbledCircuit->q; i++) {
+      GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
+      int a = literals[garbledGate->input0];
+      int b = literals[garbledGate->input1];
+      int output = garbledGate->output;
+
+      switch (garbledGate->type) {
+        case XORGATE:
+          literals[output] = xorLiterals(a, b, output);
+          break;
+        case ANDGATE:
+          literals[output] = andLiterals(a, b, output);
+          break;
+        case ORGATE:
+          // a | b = !(!a & !b)
+          literals[output] = andLiterals(a ^ 1, b ^ 1, output) ^ 1;
+          break;
+        case NOTGATE:
+          literals[output] = b ^ 1;
+          break;
+        default:
+          dbgs("unsupported gate type");
+          exit(1);
+      }
+    }
+
+    garbledCircuit->fixedWireIndices.clear();
+    for (int i = 0; i < garbledCircuit->m; i++) {
+      garbledCircuit->outputs[i] = literalToWire(literals[garbledCircuit->outputs[i]]);
+    }
+
+    removeDeadGates();
+  }
+
+ private:
+  // Adds a gate unless an identical one exists, and returns the wire that
+  // carries its output. A new gate writes to output if it is not negative,
+  // and to a new wire otherwise.
+  int addGate(int type, uint32_t input0, uint32_t input1, int output) {
+    if (input0 > input1 && type != NOTGATE) {
+      swap(input0, input1);
+    }
+    if (output < 0) {
+      output = nextWire++;
+    }
+
+    int existing = table.findOrInsert(type, input0, input1, output);
+    if (existing >= 0) {
+      return existing;
+    }
+
+    GarbledGate garbledGate = { input0, input1, (uint32_t) output, type };
+    gates.push_back(garbledGate);
+    return output;
+  }
+
+  // Returns a wire that carries the value of a non-constant literal, adding
+  // a NOT gate if the literal is negated.
+  int materialize(int literal) {
+    int wire = literalWire(literal);
+    if (!isNegated(literal)) {
+      return wire;
+    }
+    return addGate(NOTGATE, wire, wire, -1);
+  }
+
+  int xorLiterals(int a, int b, int output) {
+    if (isConstant(a)) {
+      return b ^ isNegated(a);
+    }
+    if (isConstant(b)) {
+      return a ^ isNegated(b);
+    }
+    int negated = isNegated(a ^ b);
+    if (literalWire(a) == literalWire(b)) {
+      return FALSE_LITERAL ^ negated;
+    }
+    // negations of the inputs carry over to the output for free
+    return 2 * addGate(XORGATE, literalWire(a), literalWire(b), output) + negated;
+  }
+
+  int andLiterals(int a, int b, int output) {
+    if (isConstant(a)) {
+      return (a == TRUE_LITERAL) ? b : FALSE_LITERAL;
+    }
+    if (isConstant(b)) {
+      return (b == TRUE_LITERAL) ? a : FALSE_LITERAL;
+    }
+    if (literalWire(a) == literalWire(b)) {
+      return (a == b) ? a : FALSE_LITERAL;
+    }
+    return 2 * addGate(ANDGATE, materialize(a), materialize(b), output);
+  }
+
+  // Returns a wire for an output literal. Constant outputs share one fixed
+  // wire per value.
+  int literalToWire(int literal) {
+    if (!isConstant(literal)) {
+      return materialize(literal);
+    }
+
+    int value = isNegated(literal);
+    if (constantWires[value] < 0) {
+      constantWires[value] = nextWire++;
+      garbledCircuit->fixedWireIndices.push_back(
+          pair<int, int>(constantWires[value], value ? FIXED_ONE_GATE : FIXED_ZERO_GATE));
+    }
+    return constantWires[value];
+  }
+
+  // Drops the gates whose outputs are never used, and replaces the gates of
+  // the circuit with the remaining ones.
+  void removeDeadGates() {
+    vector<char> live(nextWire, 0);
+    for (int i = 0; i < garbledCircuit->m; i++) {
+      live[garbledCircuit->outputs[i]] = 1;
+    }
+    for (size_t i = gates.size(); i-- > 0;) {
+      if (live[gates[i].output]) {
+        live[gates[i].input0] = live[gates[i].input1] = 1;
+      } else {
+        gates[i].type = -1;
+      }
+    }
+
+    int q = 0;
+    for (size_t i = 0; i < gates.size(); i++) {
+      if (gates[i].type >= 0) {
+        gates[q++] = gates[i];
+      }
+    }
+
+    free(garbledCircuit->garbledGates);
+    garbledCircuit->garbledGates = (GarbledGate*) memalign(128, sizeof(GarbledGate) * max(q, 1));
+    if (garbledCircuit->garbledGates == NULL) {
+      dbgs("Memory allocation error");
+      exit(1);
+    }
+    memcpy(garbledCircuit->garbledGates, gates.data(), sizeof(GarbledGate) * q);
+    garbledCircuit->q = q;
+    garbledCircuit->r = nextWire;
+  }
+
+  GarbledCircuit *garbledCircuit;
+  GateTable table;
+  vector<GarbledGate> gates;
+  int nextWire;
+  int constantWires[2];
+};
+
+}  // namespace
+
+void optimizeCircuit(GarbledCircuit *garbledCircuit) {
+  Optimizer optimizer(garbledCircuit);
+  optimizer.run();
+}
@@ -0,0 +1,63 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "include/garble.h"
+#include "include/justGarble.h"
+
+// Gives wire the next free index if it does not have one yet.
+static inline int renumber(int *newIndex, int *nextIndex, int wire) {
+  if (newIndex[wire] < 0) {
+    newIndex[wire] = (*nextIndex)++;
+  }
+  return newIndex[wire];
+}
+
+void renumberWires(GarbledCircuit *garbledCircuit) {
+  int *newIndex = (int*) malloc(sizeof(int) * garbledCircuit->r);
+  if (newIndex == NULL && garbledCircuit->r > 0) {
+    dbgs("Memory allocation error");
+    exit(1);
+  }
+  memset(newIndex, -1, sizeof(int) * garbledCircuit->r);
+  int nextIndex = 0;
+
+  for (int i = 0; i < garbledCircuit->q; i++) {
+    GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
+    garbledGate->input0 = renumber(newIndex, &nextIndex, garbledGate->input0);
+    garbledGate->input1 = renumber(newIndex, &nextIndex, garbledGate->input1);
+    garbledGate->output = renumber(newIndex, &nextIndex, garbledGate->output);
+  }
+
+  // Inputs, fixed wires and outputs that no gate reads still need a slot.
+  for (int i = 0; i < garbledCircuit->n; i++) {
+    garbledCircuit->inputWires[i] = renumber(newIndex, &nextIndex, garbledCircuit->inputWires[i]);
+  }
+  for (uint32_t i = 0; i < garbledCircuit->fixedWireIndices.size(); i++) {
+    pair<int, int> &w = garbledCircuit->fixedWireIndices[i];
+    w.first = renumber(newIndex, &nextIndex, w.first);
+  }
+  for (int i = 0; i < garbledCircuit->m; i++) {
+    garbledCircuit->outputs[i] = renumber(newIndex, &nextIndex, garbledCircuit->outputs[i]);
+  }
+
+  garbledCircuit->r = nextIndex;
+  free(newIndex);
+}
@@ -0,0 +1,372 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "include/garble.h"
+#include "include/justGarble.h"
+#include "include/aesbatch.h"
+#include "include/threadpool.h"
+
+#include <malloc.h>
+
+// A replicated stage is processed LANES instances at a time. The labels of
+// the instances in flight are interleaved, so that the label of wire w in
+// lane l is at labels[w * LANES + l], and every gate of the instance is
+// applied to all lanes before moving on. AND gates therefore hash one block
+// per label and lane in a single call, while only one copy of the topology
+// is ever read.
+//
+// Instance e of the stage uses gate ids e * q + g for its hash tweaks, the
+// tables e * nAndGates + k and the fixed labels e * nFixed + f, where q,
+// nAndGates and nFixed count the gates, AND gates and fixed wires of one
+// instance. The gates after the stage continue from the last of each.
+
+void addReplicatedStage(GarbledCircuit *garbledCircuit, GarbledCircuit *instance, int nInstances, int nInputs,
+                        int *inputOffsets, int *inputStrides, int *outputOffsets, int *outputStrides) {
+  if (garbledCircuit->stage != NULL) {
+    dbgs("circuit already has a replicated stage");
+    exit(1);
+  }
+
+  ReplicatedStage *stage = new ReplicatedStage;
+  stage->instance = *instance;
+  stage->nInstances = nInstances;
+  stage->nBodyInputs = garbledCircuit->n;
+
+  int n = instance->n;
+  int m = instance->m;
+  stage->inputOffsets = new int[n];
+  stage->inputStrides = new int[n];
+  stage->outputOffsets = new int[m];
+  stage->outputStrides = new int[m];
+  memcpy(stage->inputOffsets, inputOffsets, sizeof(int) * n);
+  memcpy(stage->inputStrides, inputStrides, sizeof(int) * n);
+  memcpy(stage->outputOffsets, outputOffsets, sizeof(int) * m);
+  memcpy(stage->outputStrides, outputStrides, sizeof(int) * m);
+
+  garbledCircuit->stage = stage;
+  garbledCircuit->n = nInputs;
+  garbledCircuit->nAndGates += nInstances * instance->nAndGates;
+
+  // the tables of the stage come first
+  free(garbledCircuit->garbledTable);
+  garbledCircuit->garbledTable = NULL;
+}
+
+long getNumGates(GarbledCircuit *garbledCircuit) {
+  long q = garbledCircuit->q;
+  if (garbledCircuit->stage != NULL) {
+    q += (long) garbledCircuit->stage->nInstances * garbledCircuit->stage->instance.q;
+  }
+  return q;
+}
+
+// Sets the fixed wires of the lanes starting at instance e.
+static void setFixedLabels(ReplicatedStage *stage, block *labels, int lanesInUse, int lanes, int e,
+                           block R, DKCipherContext *fixedWireCipherContext) {
+  GarbledCircuit *instance = &(stage->instance);
+  int nFixed = instance->fixedWireIndices.size();
+  if (nFixed == 0) {
+    return;
+  }
+
+  block *fixedLabels = new block[nFixed * lanesInUse];
+  for (int l = 0; l < lanesInUse; l++) {
+    for (int f = 0; f < nFixed; f++) {
+      fixedLabels[l * nFixed + f] = makeBlock((long) (e + l) * nFixed + f, (long) 0);
+    }
+  }
+  GC_AES_ecb_encrypt_blks(fixedLabels, nFixed * lanesInUse, &(fixedWireCipherContext->K));
+
+  for (int f = 0; f < nFixed; f++) {
+    const pair<int, int> w = instance->fixedWireIndices[f];
+    for (int l = 0; l < lanesInUse; l++) {
+      block label = fixedLabels[l * nFixed + f];
+      if (w.second == FIXED_ONE_GATE) {
+        // only the garbler passes R, see garbleCircuit
+        label = xorBlocks(label, R);
+      }
+      labels[(long) w.first * lanes + l] = label;
+    }
+  }
+  delete[] fixedLabels;
+}
+
+// Copies the output labels of the lanes starting at instance e to the input
+// wires of the rest of the circuit.
+static void storeOutputs(GarbledCircuit *garbledCircuit, block *labels, int lanesInUse, int lanes, int e,
+                         block *circuitLabels) {
+  ReplicatedStage *stage = garbledCircuit->stage;
+  GarbledCircuit *instance = &(stage->instance);
+  for (int j = 0; j < instance->m; j++) {
+    block *src = labels + (long) instance->outputs[j] * lanes;
+    for (int l = 0; l < lanesInUse; l++) {
+      long t = stage->outputOffsets[j] + (long) (e + l) * stage->outputStrides[j];
+      circuitLabels[garbledCircuit->inputWires[t]] = src[l];
+    }
+  }
+}
+
+// Garbles instances [begin, end) of the stage. tables holds the tables of
+// the instances from firstInstance on.
+static void garbleInstances(GarbledCircuit *garbledCircuit, InputLabelSource *source,
+                            DKCipherContext *dkCipherContext, DKCipherContext *fixedWireCipherContext,
+                            int begin, int end, GarbledTable *tables, int firstInstance) {
+  const int lanes = GARBLE_BATCH_SIZE;
+  ReplicatedStage *stage = garbledCircuit->stage;
+  GarbledCircuit *instance = &(stage->instance);
+
+  block *labels = (block*) memalign(128, sizeof(block) * instance->r * lanes);
+  block *inputLabels = (block*) memalign(128, sizeof(block) * instance->n * lanes);
+  long *inputs = new long[instance->n * lanes];
+  if (labels == NULL || inputLabels == NULL) {
+    dbgs("Memory allocation error");
+    exit(1);
+  }
+  block hashInputs[4 * lanes];
+  block hashValues[GC_AES_BATCH_BLOCKS];
+  block R = source->R;
+  block doubleR = DOUBLE(R);
+
+  for (int e = begin; e < end; e += lanes) {
+    int lanesInUse = min(lanes, end - e);
+
+    // the input labels of the lanes are derived together
+    for (int j = 0; j < instance->n; j++) {
+      for (int l = 0; l < lanesInUse; l++) {
+        inputs[j * lanesInUse + l] = stage->inputOffsets[j] + (long) (e + l) * stage->inputStrides[j];
+      }
+    }
+    getInputLabels(source, inputs, instance->n * lanesInUse, inputLabels);
+    for (int j = 0; j < instance->n; j++) {
+      memcpy(labels + (long) instance->inputWires[j] * lanes, inputLabels + j * lanesInUse,
+             sizeof(block) * lanesInUse);
+    }
+    setFixedLabels(stage, labels, lanesInUse, lanes, e, R, fixedWireCipherContext);
+
+    int andIndex = 0;
+    for (int g = 0; g < instance->q; g++) {
+      GarbledGate *garbledGate = &(instance->garbledGates[g]);
+      block *A = labels + (long) garbledGate->input0 * lanes;
+      block *B = labels + (long) garbledGate->input1 * lanes;
+      block *out = labels + (long) garbledGate->output * lanes;
+
+      if (garbledGate->type == XORGATE) {
+        for (int l = 0; l < lanesInUse; l++) {
+          out[l] = xorBlocks(A[l], B[l]);
+        }
+        continue;
+      }
+      if (garbledGate->type == NOTGATE) {
+        for (int l = 0; l < lanesInUse; l++) {
+          out[l] = xorBlocks(A[l], R);
+        }
+        continue;
+      }
+
+      for (int l = 0; l < lanesInUse; l++) {
+        long id = (long) (e + l) * instance->q + g;
+        block tweak0 = makeBlock(2*id, (long) 0);
+        block tweak1 = makeBlock(2*id + 1, (long) 0);
+        hashInputs[4*l]     = xorBlocks(DOUBLE(A[l]), tweak0);
+        hashInputs[4*l + 1] = xorBlocks(hashInputs[4*l], doubleR);
+        hashInputs[4*l + 2] = xorBlocks(DOUBLE(B[l]), tweak1);
+        hashInputs[4*l + 3] = xorBlocks(hashInputs[4*l + 2], doubleR);
+      }
+
+      memcpy(hashValues, hashInputs, 4 * lanesInUse * sizeof(block));
+      GC_AES_ecb_encrypt_blks_batch(hashValues, 4 * lanesInUse, &(dkCipherContext->K));
+
+      for (int l = 0; l < lanesInUse; l++) {
+        block *h = hashValues + 4*l;
+        for (int k = 0; k < 4; k++) {
+          h[k] = xorBlocks(h[k], hashInputs[4*l + k]);
+        }
+
+        block A0 = A[l];
+        block mask0 = getLSBMask(A0);
+        block mask1 = getLSBMask(B[l]);
+
+        // first half gate
+        block TG = xorBlocks(xorBlocks(h[0], h[1]), _mm_and_si128(R, mask1));
+        block WG = xorBlocks(h[0], _mm_and_si128(TG, mask0));
+
+        // second half gate
+        block TE = xorBlocks(h[2], h[3]);
+        block WE = xorBlocks(h[2], _mm_and_si128(TE, mask1));
+        TE = xorBlocks(TE, A0);
+
+        out[l] = xorBlocks(WG, WE);
+
+        GarbledTable *garbledTable = &(tables[(long) (e + l - firstInstance) * instance->nAndGates + andIndex]);
+        garbledTable->table[0] = TG;
+        garbledTable->table[1] = TE;
+      }
+      andIndex++;
+    }
+
+    storeOutputs(garbledCircuit, labels, lanesInUse, lanes, e, garbledCircuit->wireLabels0);
+  }
+
+  free(labels);
+  free(inputLabels);
+  delete[] inputs;
+}
+
+// Evaluates instances [begin, end) of the stage, as garbleInstances.
+static void evaluateInstances(GarbledCircuit *garbledCircuit, ExtractedLabels extractedLabels,
+                              DKCipherContext *dkCipherContext, DKCipherContext *fixedWireCipherContext,
+                              int begin, int end, GarbledTable *tables, int firstInstance) {
+  const int lanes = EVAL_BATCH_SIZE;
+  ReplicatedStage *stage = garbledCircuit->stage;
+  GarbledCircuit *instance = &(stage->instance);
+
+  block *labels = (block*) memalign(128, sizeof(block) * instance->r * lanes);
+  if (labels == NULL) {
+    dbgs("Memory allocation error");
+    exit(1);
+  }
+  block hashInputs[2 * lanes];
+  block hashValues[GC_AES_BATCH_BLOCKS];
+
+  for (int e = begin; e < end; e += lanes) {
+    int lanesInUse = min(lanes, end - e);
+
+    for (int j = 0; j < instance->n; j++) {
+      block *dst = labels + (long) instance->inputWires[j] * lanes;
+      for (int l = 0; l < lanesInUse; l++) {
+        dst[l] = extractedLabels[stage->inputOffsets[j] + (long) (e + l) * stage->inputStrides[j]];
+      }
+    }
+    setFixedLabels(stage, labels, lanesInUse, lanes, e, zero_block(), fixedWireCipherContext);
+
+    int andIndex = 0;
+    for (int g = 0; g < instance->q; g++) {
+      GarbledGate *garbledGate = &(instance->garbledGates[g]);
+      block *A = labels + (long) garbledGate->input0 * lanes;
+      block *B = labels + (long) garbledGate->input1 * lanes;
+      block *out = labels + (long) garbledGate->output * lanes;
+
+      if (garbledGate->type == XORGATE) {
+        for (int l = 0; l < lanesInUse; l++) {
+          out[l] = xorBlocks(A[l], B[l]);
+        }
+        continue;
+      }
+      if (garbledGate->type == NOTGATE) {
+        memcpy(out, A, sizeof(block) * lanesInUse);
+        continue;
+      }
+
+      for (int l = 0; l < lanesInUse; l++) {
+        long id = (long) (e + l) * instance->q + g;
+        block tweak0 = makeBlock(2*id, (long) 0);
+        block tweak1 = makeBlock(2*id + 1, (long) 0);
+        hashInputs[2*l]     = xorBlocks(DOUBLE(A[l]), tweak0);
+        hashInputs[2*l + 1] = xorBlocks(DOUBLE(B[l]), tweak1);
+      }
+
+      memcpy(hashValues, hashInputs, 2 * lanesInUse * sizeof(block));
+      GC_AES_ecb_encrypt_blks_batch(hashValues, 2 * lanesInUse, &(dkCipherContext->K));
+
+      for (int l = 0; l < lanesInUse; l++) {
+        GarbledTable *garbledTable = &(tables[(long) (e + l - firstInstance) * instance->nAndGates + andIndex]);
+        block a = A[l];
+
+        block WG = xorBlocks(hashValues[2*l], hashInputs[2*l]);
+        WG = xorBlocks(WG, _mm_and_si128(garbledTable->table[0], getLSBMask(a)));
+
+        block WE = xorBlocks(hashValues[2*l + 1], hashInputs[2*l + 1]);
+        WE = xorBlocks(WE, _mm_and_si128(xorBlocks(garbledTable->table[1], a), getLSBMask(B[l])));
+
+        out[l] = xorBlocks(WG, WE);
+      }
+      andIndex++;
+    }
+
+    storeOutputs(garbledCircuit, labels, lanesInUse, lanes, e, garbledCircuit->wireLabels);
+  }
+
+  free(labels);
+}
+
+// Returns the buffer for the tables of the stage: garbledTable, or with a
+// sink or source, a buffer for one wave of instances.
+static GarbledTable *getStageTables(GarbledCircuit *garbledCircuit, bool streamed, int wave) {
+  if (!streamed) {
+    return getGarbledTable(garbledCircuit);
+  }
+
+  long nTables = (long) wave * garbledCircuit->stage->instance.nAndGates;
+  GarbledTable *tables = (GarbledTable*) memalign(128, sizeof(GarbledTable) * nTables);
+  if (tables == NULL && nTables > 0) {
+    dbgs("Memory allocation error");
+    exit(1);
+  }
+  return tables;
+}
+
+void garbleReplicatedStage(GarbledCircuit *garbledCircuit, InputLabelSource *source,
+                           DKCipherContext *dkCipherContext, DKCipherContext *fixedWireCipherContext,
+                           const TableSink &sink) {
+  int nInstances = garbledCircuit->stage->nInstances;
+  int nInstanceTables = garbledCircuit->stage->instance.nAndGates;
+  int wave = sink ? min(TABLE_INSTANCE_WAVE, nInstances) : nInstances;
+  GarbledTable *tables = getStageTables(garbledCircuit, (bool) sink, wave);
+
+  for (int first = 0; first < nInstances; first += wave) {
+    int count = min(wave, nInstances - first);
+    parallelFor(count, INSTANCE_CHUNK_SIZE, [=](int begin, int end) {
+      garbleInstances(garbledCircuit, source, dkCipherContext, fixedWireCipherContext, first + begin, first + end,
+                      tables, sink ? first : 0);
+    });
+    if (sink && nInstanceTables > 0) {
+      sink(tables, count * nInstanceTables);
+    }
+  }
+
+  if (sink) {
+    free(tables);
+  }
+}
+
+void evaluateReplicatedStage(GarbledCircuit *garbledCircuit, ExtractedLabels extractedLabels,
+                             DKCipherContext *dkCipherContext, DKCipherContext *fixedWireCipherContext,
+                             const TableSource &tableSource) {
+  int nInstances = garbledCircuit->stage->nInstances;
+  int nInstanceTables = garbledCircuit->stage->instance.nAndGates;
+  int wave = tableSource ? min(TABLE_INSTANCE_WAVE, nInstances) : nInstances;
+  GarbledTable *tables = getStageTables(garbledCircuit, (bool) tableSource, wave);
+
+  for (int first = 0; first < nInstances; first += wave) {
+    int count = min(wave, nInstances - first);
+    if (tableSource && nInstanceTables > 0) {
+      tableSource(tables, count * nInstanceTables);
+    }
+    parallelFor(count, INSTANCE_CHUNK_SIZE, [=](int begin, int end) {
+      evaluateInstances(garbledCircuit, extractedLabels, dkCipherContext, fixedWireCipherContext, first + begin,
+                        first + end, tables, tableSource ? first : 0);
+    });
+  }
+
+  if (tableSource) {
+    free(tables);
+  }
+}
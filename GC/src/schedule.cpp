@@ -0,0 +1,98 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "include/garble.h"
+#include "include/justGarble.h"
+
+#include <algorithm>
+#include <malloc.h>
+
+// The level of a wire is the largest number of gates on any path from an
+// input or fixed wire to it. Every gate is given the key 3*d + c, where d is
+// the level of its inputs and c is 0, 1 or 2 for XOR, NOT and AND gates, and
+// the gates of each window are stably sorted by key. A gate only depends on gates with smaller keys, so this is
+// a valid topological order, and the gates that share a key (which form a
+// run) never depend on one another.
+void scheduleCircuit(GarbledCircuit *garbledCircuit, int window) {
+  int q = garbledCircuit->q;
+  GarbledGate *garbledGates = garbledCircuit->garbledGates;
+
+  garbledCircuit->runs.clear();
+  if (q == 0) {
+    return;
+  }
+
+  int *depth = (int*) calloc(garbledCircuit->r, sizeof(int));
+  int *keys = (int*) malloc(sizeof(int) * q);
+  int *order = (int*) malloc(sizeof(int) * q);
+  GarbledGate *scheduled = (GarbledGate*) memalign(128, sizeof(GarbledGate) * q);
+  if ((depth == NULL && garbledCircuit->r > 0) || keys == NULL ||
+      order == NULL || scheduled == NULL) {
+    dbgs("Memory allocation error");
+    exit(1);
+  }
+
+  for (int i = 0; i < q; i++) {
+    GarbledGate *garbledGate = &(garbledGates[i]);
+    int c;
+    if (garbledGate->type == XORGATE) {
+      c = 0;
+    } else if (garbledGate->type == NOTGATE) {
+      c = 1;
+    } else if (garbledGate->type == ANDGATE) {
+      c = 2;
+    } else {
+      dbgs("currently only support AND, XOR and NOT gates");
+      exit(1);
+    }
+
+    int d = max(depth[garbledGate->input0], depth[garbledGate->input1]);
+    keys[i] = 3*d + c;
+    depth[garbledGate->output] = d + 1;
+    order[i] = i;
+  }
+
+  for (int start = 0; start < q; start += window) {
+    int end = min(start + window, q);
+    stable_sort(order + start, order + end,
+                [keys](int a, int b) { return keys[a] < keys[b]; });
+  }
+
+  for (int i = 0; i < q; i++) {
+    scheduled[i] = garbledGates[order[i]];
+
+    bool newRun = (i == 0) || keys[order[i]] != keys[order[i - 1]];
+
+    if (newRun) {
+      GateRun run = { scheduled[i].type, i, 1 };
+      garbledCircuit->runs.push_back(run);
+    } else {
+      garbledCircuit->runs.back().count++;
+    }
+  }
+
+  free(garbledCircuit->garbledGates);
+  garbledCircuit->garbledGates = scheduled;
+
+  free(depth);
+  free(keys);
+  free(order);
+}
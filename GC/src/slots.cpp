@@ -0,0 +1,114 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "include/garble.h"
+#include "include/justGarble.h"
+
+void assignWireSlots(GarbledCircuit *garbledCircuit) {
+  int r = garbledCircuit->r;
+  int *lastUse = (int*) malloc(sizeof(int) * r);
+  int *slots = (int*) malloc(sizeof(int) * r);
+  if ((lastUse == NULL || slots == NULL) && r > 0) {
+    dbgs("Memory allocation error");
+    exit(1);
+  }
+  memset(lastUse, -1, sizeof(int) * r);
+  memset(slots, -1, sizeof(int) * r);
+
+  for (int i = 0; i < garbledCircuit->q; i++) {
+    lastUse[garbledCircuit->garbledGates[i].input0] = i;
+    lastUse[garbledCircuit->garbledGates[i].input1] = i;
+  }
+  // outputs are never released
+  for (int i = 0; i < garbledCircuit->m; i++) {
+    lastUse[garbledCircuit->outputs[i]] = garbledCircuit->q;
+  }
+
+  // Input and fixed wires are set before the first gate, so they are all
+  // live at once and each needs a slot that no wire has used before. They
+  // get a new slot when the first gate reads them (the only wires that a
+  // gate reads before any gate has written them), so that they keep the
+  // place among the wires of their gates that renumberWires gave them.
+  int nSlots = 0;
+  auto readSlot = [&](uint32_t wire) {
+    if (slots[wire] < 0) {
+      slots[wire] = nSlots++;
+    }
+    return slots[wire];
+  };
+
+  // A slot is released once the run that reads its wire for the last time
+  // has finished, and slots are reused most-recently-released first, while
+  // the label is likely still cached. Releasing slots at the end of a run
+  // (rather than after the reading gate) lets the gates of a run be spread
+  // across threads without one overwriting a label another still needs.
+  vector<int> freeSlots, releasedSlots;
+  for (size_t k = 0; k < garbledCircuit->runs.size(); k++) {
+    const GateRun &run = garbledCircuit->runs[k];
+    for (int i = run.start; i < run.start + run.count; i++) {
+      GarbledGate *garbledGate = &(garbledCircuit->garbledGates[i]);
+      uint32_t input0 = garbledGate->input0;
+      uint32_t input1 = garbledGate->input1;
+      uint32_t output = garbledGate->output;
+
+      garbledGate->input0 = readSlot(input0);
+      garbledGate->input1 = readSlot(input1);
+      if (lastUse[input0] == i) {
+        releasedSlots.push_back(slots[input0]);
+      }
+      if (lastUse[input1] == i && input1 != input0) {
+        releasedSlots.push_back(slots[input1]);
+      }
+
+      if (freeSlots.empty()) {
+        slots[output] = nSlots++;
+      } else {
+        slots[output] = freeSlots.back();
+        freeSlots.pop_back();
+      }
+      garbledGate->output = slots[output];
+
+      // an output that is never read only needs its slot for this run
+      if (lastUse[output] < 0) {
+        releasedSlots.push_back(slots[output]);
+      }
+    }
+
+    freeSlots.insert(freeSlots.end(), releasedSlots.begin(), releasedSlots.end());
+    releasedSlots.clear();
+  }
+
+  // input and fixed wires that no gate reads
+  for (int i = 0; i < garbledCircuit->n; i++) {
+    garbledCircuit->inputWires[i] = readSlot(garbledCircuit->inputWires[i]);
+  }
+  for (uint32_t i = 0; i < garbledCircuit->fixedWireIndices.size(); i++) {
+    pair<int, int> &w = garbledCircuit->fixedWireIndices[i];
+    w.first = readSlot(w.first);
+  }
+  for (int i = 0; i < garbledCircuit->m; i++) {
+    garbledCircuit->outputs[i] = slots[garbledCircuit->outputs[i]];
+  }
+
+  garbledCircuit->r = nSlots;
+  free(lastUse);
+  free(slots);
+}
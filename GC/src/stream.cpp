@@ -0,0 +1,484 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "include/stream.h"
+#include "include/garble.h"
+#include "include/gates.h"
+#include "include/justGarble.h"
+#include "include/aesbatch.h"
+
+#include <algorithm>
+#include <malloc.h>
+
+static void *alignedAlloc(size_t size) {
+  void *p = memalign(128, size);
+  if (p == NULL) {
+    dbgs("Memory allocation error");
+    exit(1);
+  }
+  return p;
+}
+
+GateStream::GateStream(int nInputs, int nOutputs, int batchSize, block globalKey, block fixedWiresSeed)
+    : nInputs(nInputs), nOutputs(nOutputs), globalKey(globalKey), fixedWiresSeed(fixedWiresSeed), nTables(0),
+      nBuffered(0), batchSize(batchSize), nOutputsDone(0), nGates(0), nFixedWires(0),
+      lastPinned(0) {
+  DKCipherInit(&globalKey, &dkCipherContext);
+  DKCipherInit(&fixedWiresSeed, &fixedWireCipherContext);
+  buffer = (GarbledGate*) alignedAlloc(sizeof(GarbledGate) * STREAM_BUFFER_SIZE);
+  tables = (GarbledTable*) alignedAlloc(sizeof(GarbledTable) * STREAM_BUFFER_SIZE);
+
+  // resolve the AES backend before the first batch
+  GC_AES_get_backend();
+}
+
+GateStream::~GateStream() {
+  for (size_t p = 0; p < pages.size(); p++) {
+    free(pages[p]);
+  }
+  for (size_t p = 0; p < pinnedPages.size(); p++) {
+    free(pinnedPages[p]);
+  }
+  for (size_t p = 0; p < freePages.size(); p++) {
+    free(freePages[p]);
+  }
+  free(buffer);
+  free(tables);
+}
+
+// Returns page p, allocating it if needed. The inputs in a page are loaded
+// whenever it is allocated, so pages of inputs can be dropped like any
+// other, and a page allocated by a gate output that shares it with the last
+// inputs still has them.
+GateStream::LabelPage *GateStream::page(size_t p) {
+  if (p >= pages.size()) {
+    pages.resize(p + 1, NULL);
+  }
+  if (pages[p] == NULL) {
+    if (freePages.empty()) {
+      pages[p] = (LabelPage*) alignedAlloc(sizeof(LabelPage));
+    } else {
+      pages[p] = freePages.back();
+      freePages.pop_back();
+    }
+    long first = (long) p << LABEL_PAGE_BITS;
+    if (first < nInputs) {
+      loadInputs(first, min((long) LABEL_PAGE_SIZE, nInputs - first), pages[p]->labels);
+    }
+  }
+  return pages[p];
+}
+
+// Pinned labels are looked up first, since the page of a pinned wire may
+// have been dropped and allocated again for a later wire. Wires above the
+// last pinned one, which most gates read, skip the search, and the search
+// starts from the last pinned wire found, since builders read pinned wires
+// in runs that are close together.
+block &GateStream::label(int wire) {
+  if (wire >= nInputs && !pinnedWires.empty() && wire <= pinnedWires.back()) {
+    size_t k = findPinned(wire);
+    if (pinnedWires[k] == wire) {
+      return pinnedPages[k >> LABEL_PAGE_BITS]->labels[k & (LABEL_PAGE_SIZE - 1)];
+    }
+  }
+
+  size_t p = wire >> LABEL_PAGE_BITS;
+  if (p < pages.size() && pages[p] != NULL) {
+    return pages[p]->labels[wire & (LABEL_PAGE_SIZE - 1)];
+  }
+  if (wire >= nInputs) {
+    dbgs("streamed gate reads a wire that was never written or has been dropped");
+    exit(1);
+  }
+  return page(p)->labels[wire & (LABEL_PAGE_SIZE - 1)];
+}
+
+// Returns the position of the first pinned wire that is not below wire,
+// which must not be above the last pinned wire, galloping out from the last
+// position found.
+size_t GateStream::findPinned(int wire) {
+  size_t n = pinnedWires.size();
+  size_t low, high;
+  size_t step = 1;
+  if (pinnedWires[lastPinned] < wire) {
+    low = lastPinned + 1;
+    while (low + step < n && pinnedWires[low + step] < wire) {
+      low += step + 1;
+      step *= 2;
+    }
+    high = min(n, low + step + 1);
+  } else {
+    high = lastPinned + 1;
+    while (high > step && pinnedWires[high - step - 1] >= wire) {
+      high -= step;
+      step *= 2;
+    }
+    low = (high > step) ? high - step : 0;
+  }
+  lastPinned = lower_bound(pinnedWires.begin() + low, pinnedWires.begin() + high, wire) - pinnedWires.begin();
+  return lastPinned;
+}
+
+block &GateStream::newLabel(int wire) {
+  size_t p = wire >> LABEL_PAGE_BITS;
+  if (p < pages.size() && pages[p] != NULL) {
+    return pages[p]->labels[wire & (LABEL_PAGE_SIZE - 1)];
+  }
+  return page(p)->labels[wire & (LABEL_PAGE_SIZE - 1)];
+}
+
+long GateStream::getNumLabelPages() const {
+  return count_if(pages.begin(), pages.end(), [](LabelPage *page) { return page != NULL; });
+}
+
+void GateStream::addGate(int type, int input0, int input1, int output) {
+  GarbledGate *gate = &(buffer[nBuffered++]);
+  gate->type = type;
+  gate->input0 = input0;
+  gate->input1 = input1;
+  gate->output = output;
+  if (nBuffered == STREAM_BUFFER_SIZE) {
+    flush();
+  }
+}
+
+// Fixed labels are AES(fixedWiresSeed, i) for the i-th fixed wire, as in
+// garbleCircuit, and are set right away since they depend on no gate.
+void GateStream::addFixedWire(int wire, int type) {
+  block fixedLabel = makeBlock(nFixedWires++, (long) 0);
+  GC_AES_ecb_encrypt_blks(&fixedLabel, 1, &(fixedWireCipherContext.K));
+  setFixedLabel(wire, type, fixedLabel);
+}
+
+// The buffered gates are processed in order, except that AND and OR gates
+// are held back and hashed batchSize at a time. A gate that reads the
+// output of a held-back gate first processes the batch, so every gate
+// still sees its inputs. Each AND or OR gate has the id of its position
+// among all gates, and the table of its position among those of the
+// buffer, whatever the batch size of either side.
+void GateStream::flush() {
+  if (nBuffered == 0) {
+    return;
+  }
+
+  int nBufferTables = 0;
+  for (int i = 0; i < nBuffered; i++) {
+    if (buffer[i].type == ANDGATE || buffer[i].type == ORGATE) {
+      nBufferTables++;
+    }
+  }
+  readTables(nBufferTables);
+
+  PendingGate batch[EVAL_BATCH_SIZE];
+  int nPending = 0, table = 0;
+  for (int i = 0; i < nBuffered; i++) {
+    const GarbledGate *gate = &(buffer[i]);
+    for (int j = 0; j < nPending; j++) {
+      uint32_t output = batch[j].gate->output;
+      if (gate->input0 == output || gate->input1 == output) {
+        processANDBatch(batch, nPending);
+        nPending = 0;
+        break;
+      }
+    }
+
+    if (gate->type == ANDGATE || gate->type == ORGATE) {
+      batch[nPending].gate = gate;
+      batch[nPending].id = nGates + i;
+      batch[nPending].table = table++;
+      if (++nPending == batchSize) {
+        processANDBatch(batch, nPending);
+        nPending = 0;
+      }
+    } else if (gate->type == XORGATE || gate->type == NOTGATE) {
+      processFreeGate(gate);
+    } else {
+      dbgs("currently only support AND, OR, XOR and NOT gates");
+      exit(1);
+    }
+  }
+  if (nPending > 0) {
+    processANDBatch(batch, nPending);
+  }
+
+  writeTables(nBufferTables);
+  nTables += nBufferTables;
+  nGates += nBuffered;
+  nBuffered = 0;
+}
+
+// The store is sorted by wire, so pinned wires must come after those
+// pinned before, as they do when a builder pins wires once they are
+// written.
+void GateStream::pin(const int *wires, int count) {
+  flush();
+
+  vector<int> added;
+  for (int i = 0; i < count; i++) {
+    if (wires[i] >= nInputs) {
+      added.push_back(wires[i]);
+    }
+  }
+  sort(added.begin(), added.end());
+  added.erase(unique(added.begin(), added.end()), added.end());
+  if (!added.empty() && !pinnedWires.empty() && added[0] <= pinnedWires.back()) {
+    dbgs("streamed wires must be pinned in order");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < added.size(); i++) {
+    size_t k = pinnedWires.size();
+    if ((k & (LABEL_PAGE_SIZE - 1)) == 0) {
+      pinnedPages.push_back((LabelPage*) alignedAlloc(sizeof(LabelPage)));
+    }
+    pinnedPages[k >> LABEL_PAGE_BITS]->labels[k & (LABEL_PAGE_SIZE - 1)] = label(added[i]);
+    pinnedWires.push_back(added[i]);
+  }
+}
+
+void GateStream::keepOnly(const int *wires, int count) {
+  flush();
+
+  vector<int> keptWires;
+  block *keptLabels = new block[count];
+  for (int i = 0; i < count; i++) {
+    if (wires[i] >= nInputs) {
+      keptLabels[keptWires.size()] = label(wires[i]);
+      keptWires.push_back(wires[i]);
+    }
+  }
+
+  // the dropped pages are reused rather than freed, as a builder keeps
+  // about as many pages resident from one step to the next
+  for (size_t p = 0; p < pages.size(); p++) {
+    if (pages[p] != NULL) {
+      freePages.push_back(pages[p]);
+      pages[p] = NULL;
+    }
+  }
+
+  for (size_t i = 0; i < keptWires.size(); i++) {
+    newLabel(keptWires[i]) = keptLabels[i];
+  }
+  delete[] keptLabels;
+}
+
+void GateStream::output(const int *wires, int count) {
+  flush();
+  if (nOutputsDone + count > nOutputs) {
+    dbgs("streamed circuit has more outputs than it was created with");
+    exit(1);
+  }
+  for (int i = 0; i < count; i++) {
+    setOutput(nOutputsDone++, label(wires[i]));
+  }
+}
+
+void GateStream::finish() {
+  flush();
+  if (nOutputsDone != nOutputs) {
+    dbgs("streamed circuit has fewer outputs than it was created with");
+    exit(1);
+  }
+}
+
+static block freshKey() {
+  seedRandom();
+  return randomBlock();
+}
+
+GarblingStream::GarblingStream(int nInputs, int nOutputs, InputLabelSource *source, OutputMap outputMap,
+                               TableSink sink)
+    : GateStream(nInputs, nOutputs, GARBLE_BATCH_SIZE, freshKey(), freshKey()), source(source), R(source->R),
+      outputMap(outputMap), sink(sink) {
+}
+
+// Input labels are read a page at a time, as the first gate that needs
+// them is garbled, so that garbling can start before all of them exist.
+void GarblingStream::loadInputs(int first, int count, block *labels) {
+  const int batch = 256;
+  long inputs[batch];
+  for (int i = 0; i < count; i += batch) {
+    int n = min(batch, count - i);
+    for (int j = 0; j < n; j++) {
+      inputs[j] = first + i + j;
+    }
+    getInputLabels(source, inputs, n, labels + i);
+  }
+}
+
+// The garbler only keeps the 0-label of every wire. NOT gates are free: the
+// 0-label of the output is the 1-label of the input.
+void GarblingStream::processFreeGate(const GarbledGate *gate) {
+  block A0 = label(gate->input0);
+  if (gate->type == XORGATE) {
+    block B0 = label(gate->input1);
+    newLabel(gate->output) = xorBlocks(A0, B0);
+  } else {
+    newLabel(gate->output) = xorBlocks(A0, R);
+  }
+}
+
+// Half-gates, as in garbleANDBatch in garble.cpp. An OR gate is garbled as
+// an AND gate whose inputs and output are negated, which only changes the
+// garbler's 0-labels, so the evaluator handles it as an AND gate.
+void GarblingStream::processANDBatch(const PendingGate *batch, int count) {
+  block hashInputs[4 * GARBLE_BATCH_SIZE];
+  block hashValues[GC_AES_BATCH_BLOCKS];
+  block inputs0[GARBLE_BATCH_SIZE], inputs1[GARBLE_BATCH_SIZE];
+  block doubleR = DOUBLE(R);
+
+  for (int j = 0; j < count; j++) {
+    const GarbledGate *gate = batch[j].gate;
+    block flip = (gate->type == ORGATE) ? R : _mm_setzero_si128();
+    inputs0[j] = xorBlocks(label(gate->input0), flip);
+    inputs1[j] = xorBlocks(label(gate->input1), flip);
+
+    long i = batch[j].id;
+    block tweak0 = makeBlock(2*i, (long) 0);
+    block tweak1 = makeBlock(2*i + 1, (long) 0);
+
+    hashInputs[4*j]     = xorBlocks(DOUBLE(inputs0[j]), tweak0);
+    hashInputs[4*j + 1] = xorBlocks(hashInputs[4*j], doubleR);
+    hashInputs[4*j + 2] = xorBlocks(DOUBLE(inputs1[j]), tweak1);
+    hashInputs[4*j + 3] = xorBlocks(hashInputs[4*j + 2], doubleR);
+  }
+
+  memcpy(hashValues, hashInputs, 4 * count * sizeof(block));
+  GC_AES_ecb_encrypt_blks_batch(hashValues, 4 * count, &(dkCipherContext.K));
+
+  for (int j = 0; j < count; j++) {
+    const GarbledGate *gate = batch[j].gate;
+    block *h = hashValues + 4*j;
+    for (int k = 0; k < 4; k++) {
+      h[k] = xorBlocks(h[k], hashInputs[4*j + k]);
+    }
+
+    block A0 = inputs0[j];
+    block mask0 = getLSBMask(A0);
+    block mask1 = getLSBMask(inputs1[j]);
+
+    // first half gate
+    block TG = xorBlocks(xorBlocks(h[0], h[1]), _mm_and_si128(R, mask1));
+    block WG = xorBlocks(h[0], _mm_and_si128(TG, mask0));
+
+    // second half gate
+    block TE = xorBlocks(h[2], h[3]);
+    block WE = xorBlocks(h[2], _mm_and_si128(TE, mask1));
+    TE = xorBlocks(TE, A0);
+
+    block flip = (gate->type == ORGATE) ? R : _mm_setzero_si128();
+    newLabel(gate->output) = xorBlocks(xorBlocks(WG, WE), flip);
+
+    tables[batch[j].table].table[0] = TG;
+    tables[batch[j].table].table[1] = TE;
+  }
+}
+
+// The label of a fixed wire is the one that encodes its value.
+void GarblingStream::setFixedLabel(int wire, int type, block fixedLabel) {
+  newLabel(wire) = (type == FIXED_ONE_GATE) ? xorBlocks(fixedLabel, R) : fixedLabel;
+}
+
+void GarblingStream::setOutput(int i, block label0) {
+  outputMap[2*i]   = label0;
+  outputMap[2*i+1] = xorBlocks(label0, R);
+}
+
+void GarblingStream::writeTables(int count) {
+  if (count > 0) {
+    sink(tables, count);
+  }
+}
+
+EvaluatingStream::EvaluatingStream(int nInputs, int nOutputs, ExtractedLabels extractedLabels, block globalKey,
+                                   block fixedWiresSeed, TableSource source, block *outputLabels)
+    : GateStream(nInputs, nOutputs, EVAL_BATCH_SIZE, globalKey, fixedWiresSeed), extractedLabels(extractedLabels),
+      source(source), outputLabels(outputLabels) {
+}
+
+void EvaluatingStream::loadInputs(int first, int count, block *labels) {
+  memcpy(labels, extractedLabels + first, count * sizeof(block));
+}
+
+// The evaluator's label of the output of a NOT gate is that of its input.
+void EvaluatingStream::processFreeGate(const GarbledGate *gate) {
+  block A = label(gate->input0);
+  if (gate->type == XORGATE) {
+    block B = label(gate->input1);
+    newLabel(gate->output) = xorBlocks(A, B);
+  } else {
+    newLabel(gate->output) = A;
+  }
+}
+
+// As evaluateANDBatch in eval.cpp.
+void EvaluatingStream::processANDBatch(const PendingGate *batch, int count) {
+  block hashInputs[2 * EVAL_BATCH_SIZE];
+  block hashValues[GC_AES_BATCH_BLOCKS];
+
+  for (int j = 0; j < count; j++) {
+    const GarbledGate *gate = batch[j].gate;
+    long i = batch[j].id;
+    block tweak0 = makeBlock(2*i, (long) 0);
+    block tweak1 = makeBlock(2*i + 1, (long) 0);
+
+    hashInputs[2*j]     = xorBlocks(DOUBLE(label(gate->input0)), tweak0);
+    hashInputs[2*j + 1] = xorBlocks(DOUBLE(label(gate->input1)), tweak1);
+  }
+
+  memcpy(hashValues, hashInputs, 2 * count * sizeof(block));
+  GC_AES_ecb_encrypt_blks_batch(hashValues, 2 * count, &(dkCipherContext.K));
+
+  for (int j = 0; j < count; j++) {
+    const GarbledGate *gate = batch[j].gate;
+    const GarbledTable *table = &(tables[batch[j].table]);
+    block A = label(gate->input0);
+    block B = label(gate->input1);
+
+    block WG = xorBlocks(hashValues[2*j], hashInputs[2*j]);
+    WG = xorBlocks(WG, _mm_and_si128(table->table[0], getLSBMask(A)));
+
+    block WE = xorBlocks(hashValues[2*j + 1], hashInputs[2*j + 1]);
+    WE = xorBlocks(WE, _mm_and_si128(xorBlocks(table->table[1], A), getLSBMask(B)));
+
+    newLabel(gate->output) = xorBlocks(WG, WE);
+  }
+}
+
+void EvaluatingStream::setFixedLabel(int wire, int type, block fixedLabel) {
+  newLabel(wire) = fixedLabel;
+}
+
+void EvaluatingStream::setOutput(int i, block label) {
+  outputLabels[i] = label;
+}
+
+void EvaluatingStream::readTables(int count) {
+  if (count > 0) {
+    source(tables, count);
+  }
+}
+
+void startStreaming(GarbledCircuit *garbledCircuit, GarblingContext *garblingContext, GateStream *stream) {
+  startBuilding(garbledCircuit, garblingContext);
+  garblingContext->stream = stream;
+}
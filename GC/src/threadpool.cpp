@@ -0,0 +1,229 @@
+/*
+ * Much of this code is taken from JustGarble
+ * (https://github.com/irdan/justGarble). Our implementation is a
+ * slimmed-down version of JustGarble and supports the half-gates
+ * optimization (https://eprint.iacr.org/2014/756).
+ *
+ * JustGarble is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JustGarble is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JustGarble.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "include/threadpool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// Chunks waiting to be run by one thread. The owner takes chunks from the
+// front and other threads steal from the back.
+struct WorkQueue {
+  mutex lock;
+  deque<int> chunks;
+};
+
+class ThreadPool {
+ public:
+  explicit ThreadPool(int nThreads);
+  ~ThreadPool();
+
+  int size() const { return nThreads; }
+  void run(int count, int chunkSize, const function<void(int, int)> &fn);
+
+ private:
+  void runInline(int count, int chunkSize, const function<void(int, int)> &fn);
+  void workerLoop(int id);
+  bool runChunk(int id);
+  bool takeChunk(int queue, bool fromFront, int *chunk);
+
+  int nThreads;
+  vector<thread> workers;
+  WorkQueue *queues;
+
+  // held by the thread whose job the pool is running
+  mutex runLock;
+
+  mutex jobLock;
+  condition_variable jobReady, jobDone;
+  unsigned long generation;
+  bool stopping;
+
+  // the current job, set before its chunks are queued
+  const function<void(int, int)> *job;
+  int jobCount, jobChunkSize;
+  atomic<int> remaining;
+};
+
+ThreadPool::ThreadPool(int nThreads)
+    : nThreads(nThreads), generation(0), stopping(false), job(NULL),
+      jobCount(0), jobChunkSize(0), remaining(0) {
+  queues = new WorkQueue[nThreads];
+  // thread 0 is the one calling run
+  for (int i = 1; i < nThreads; i++) {
+    workers.push_back(thread(&ThreadPool::workerLoop, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> guard(jobLock);
+    stopping = true;
+  }
+  jobReady.notify_all();
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+  delete[] queues;
+}
+
+void ThreadPool::runInline(int count, int chunkSize, const function<void(int, int)> &fn) {
+  for (int begin = 0; begin < count; begin += chunkSize) {
+    fn(begin, min(begin + chunkSize, count));
+  }
+}
+
+void ThreadPool::run(int count, int chunkSize, const function<void(int, int)> &fn) {
+  int nChunks = (count + chunkSize - 1) / chunkSize;
+  if (nThreads == 1 || nChunks <= 1) {
+    runInline(count, chunkSize, fn);
+    return;
+  }
+
+  // The pool runs one job at a time. A caller that finds it busy (another
+  // pipeline thread, or a chunk of the running job) runs its chunks itself
+  // rather than waiting for the pool.
+  unique_lock<mutex> busy(runLock, try_to_lock);
+  if (!busy.owns_lock()) {
+    runInline(count, chunkSize, fn);
+    return;
+  }
+
+  {
+    lock_guard<mutex> guard(jobLock);
+    job = &fn;
+    jobCount = count;
+    jobChunkSize = chunkSize;
+    remaining = nChunks;
+    for (int t = 0; t < nThreads; t++) {
+      lock_guard<mutex> queueGuard(queues[t].lock);
+      for (int c = (long) t * nChunks / nThreads; c < (long) (t + 1) * nChunks / nThreads; c++) {
+        queues[t].chunks.push_back(c);
+      }
+    }
+    generation++;
+  }
+  jobReady.notify_all();
+
+  while (runChunk(0)) {
+  }
+
+  unique_lock<mutex> lock(jobLock);
+  jobDone.wait(lock, [this] { return remaining == 0; });
+}
+
+void ThreadPool::workerLoop(int id) {
+  unsigned long seen = 0;
+  while (true) {
+    {
+      unique_lock<mutex> lock(jobLock);
+      jobReady.wait(lock, [this, seen] { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+    }
+
+    while (runChunk(id)) {
+    }
+  }
+}
+
+bool ThreadPool::takeChunk(int queue, bool fromFront, int *chunk) {
+  lock_guard<mutex> guard(queues[queue].lock);
+  deque<int> &chunks = queues[queue].chunks;
+  if (chunks.empty()) {
+    return false;
+  }
+  if (fromFront) {
+    *chunk = chunks.front();
+    chunks.pop_front();
+  } else {
+    *chunk = chunks.back();
+    chunks.pop_back();
+  }
+  return true;
+}
+
+// Runs one chunk from the thread's own queue, or stolen from another one.
+// Returns false once every queue is empty.
+bool ThreadPool::runChunk(int id) {
+  int chunk;
+  bool found = takeChunk(id, true, &chunk);
+  for (int i = 1; !found && i < nThreads; i++) {
+    found = takeChunk((id + i) % nThreads, false, &chunk);
+  }
+  if (!found) {
+    return false;
+  }
+
+  int begin = chunk * jobChunkSize;
+  (*job)(begin, min(begin + jobChunkSize, jobCount));
+
+  if (--remaining == 0) {
+    lock_guard<mutex> guard(jobLock);
+    jobDone.notify_all();
+  }
+  return true;
+}
+
+int defaultThreads() {
+  unsigned n = thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+mutex poolLock;
+ThreadPool *pool = NULL;
+
+ThreadPool *getPool() {
+  lock_guard<mutex> guard(poolLock);
+  if (pool == NULL) {
+    pool = new ThreadPool(defaultThreads());
+  }
+  return pool;
+}
+
+}  // namespace
+
+void parallelFor(int count, int chunkSize, const function<void(int, int)> &fn) {
+  getPool()->run(count, chunkSize, fn);
+}
+
+void setNumThreads(int nThreads) {
+  if (nThreads < 1) {
+    nThreads = 1;
+  }
+  lock_guard<mutex> guard(poolLock);
+  delete pool;
+  pool = new ThreadPool(nThreads);
+}
+
+int getNumThreads() {
+  return getPool()->size();
+}
@@ -16,9 +16,11 @@
  *
  */
 
+#include <chrono>
 #include <iostream>
 #include <sstream>
 #include <stdint.h>
+#include <vector>
 
 #include "OTExtension/protocol/OTClient.h"
 
@@ -26,39 +28,72 @@
 
 using namespace std;
 
-static void RunProtocol(CSocket *socket, byte* input, void* args) {
-  clock_t startTime = clock();
+// Prints the elements whose output is 1, of the count elements from first on.
+static void PrintElements(uint32_t first, uint32_t count, const int* outputVals) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (outputVals[i] == 1) {
+      cout << (first + i) << " ";
+    }
+  }
+}
+
+static void RunProtocol(Connection* connection, byte* input, void* args) {
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
 
   uint32_t nElems = ((SetDiffArgs*) args)->nElems;
   uint32_t nBits  = ((SetDiffArgs*) args)->nBits;
+  uint32_t chunkSize = ((SetDiffArgs*) args)->chunkSize;
 
   uint64_t nClientInputWires = nElems * (nBits + 1);
   uint64_t nInputWires = 2 * nClientInputWires;
   uint64_t nOutputWires = nElems;
 
-  GarbledCircuit circuit;
-  CreateSetDiffCircuit(circuit, nElems, nBits);
-
-  int *outputVals = new int[nOutputWires];
-  RunClientProtocol(socket, circuit, input, outputVals, nInputWires, nClientInputWires, nOutputWires);
-
-  double timeElapsed = (double)(clock() - startTime) / CLOCKS_PER_SEC;
-
-  cout << endl << "output: ";
-  for (int i = 0; i < nElems; i++) {
-    if (outputVals[i] == 1) {
-      cout << i << " ";
+  Circuit circuit;
+  long nAndGates = 0;
+  double timeElapsed;
+  if (chunkSize > 0) {
+    // the elements of each chunk are collected as soon as it is decoded,
+    // and printed once the protocol (and its timing) is done
+    vector<uint32_t> elements;
+    RunChunkedClientProtocol(connection, SetDiffOp(nBits), input, NULL, nElems, chunkSize, &nAndGates,
+                             [&](uint32_t first, uint32_t count, const int* outputVals) {
+      for (uint32_t i = 0; i < count; i++) {
+        if (outputVals[i] == 1) {
+          elements.push_back(first + i);
+        }
+      }
+    });
+    timeElapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    cout << endl << "output: ";
+    for (uint32_t element : elements) {
+      cout << element << " ";
     }
+    cout << endl << endl;
+  } else {
+    int *outputVals = new int[nOutputWires];
+    CreateSetDiffCircuit(*circuit, nElems, nBits);
+    RunClientProtocol(connection, *circuit, input, outputVals, nInputWires, nClientInputWires, nOutputWires);
+    timeElapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    cout << endl << "output: ";
+    PrintElements(0, nElems, outputVals);
+    cout << endl << endl;
+
+    delete[] outputVals;
   }
-  cout << endl << endl;
 
   cout << "Number of elements:  " << nElems << endl;
-  PrintStatistics(socket, circuit, timeElapsed);
+  if (chunkSize > 0) {
+    PrintStatistics(connection, nAndGates, timeElapsed);
+  } else {
+    PrintStatistics(connection, *circuit, timeElapsed);
+  }
 }
 
 int main(int argc, const char **argv) {
   if (argc < 4) {
-    cout << "usage: ./BasicIntersectionClient input nElems nBits [port]" << endl;
+    cout << "usage: ./SetDiffClient input nElems nBits [port [chunkSize]]" << endl;
     return 1;
   }
 
@@ -69,6 +104,10 @@ int main(int argc, const char **argv) {
   if (argc > 4) {
     port = atoi(argv[4]);
   }
+  uint32_t chunkSize = 0;
+  if (argc > 5) {
+    chunkSize = atoi(argv[5]);
+  }
 
   byte* input = new byte[nElems * (nBits + 1)];
   if (!ReadInputFile(input, inputFile, nElems * (nBits + 1))) {
@@ -77,7 +116,7 @@ int main(int argc, const char **argv) {
   }
   ClientLog("finished reading input");
 
-  SetDiffArgs args(nElems, nBits);
+  SetDiffArgs args(nElems, nBits, chunkSize);
   StartClient("127.0.0.1", port, input, &args, RunProtocol);
 
   delete[] input;
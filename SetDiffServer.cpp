@@ -26,24 +26,32 @@
 
 using namespace std;
 
-static void RunProtocol(CSocket *socket, byte* input, void* args) {
+static void RunProtocol(Connection* connection, byte* input, void* args) {
   uint32_t nElems = ((SetDiffArgs*) args)->nElems;
   uint32_t nBits  = ((SetDiffArgs*) args)->nBits;
+  uint32_t chunkSize = ((SetDiffArgs*) args)->chunkSize;
+
+  if (chunkSize > 0) {
+    if (!RunChunkedServerProtocol(connection, SetDiffOp(nBits), input, nElems, chunkSize)) {
+      ServerLog("protocol execution failed");
+    }
+    return;
+  }
 
   uint64_t nServerInputWires = nElems * (nBits + 1);
   uint64_t nInputWires = 2 * nServerInputWires;
 
-  GarbledCircuit circuit;
-  CreateSetDiffCircuit(circuit, nElems, nBits);
+  Circuit circuit;
+  CreateSetDiffCircuit(*circuit, nElems, nBits);
 
-  if (!RunServerProtocol(socket, circuit, input, nInputWires, nServerInputWires)) {
+  if (!RunServerProtocol(connection, *circuit, input, nInputWires, nServerInputWires)) {
     ServerLog("protocol execution failed");
   }
 }
 
 int main(int argc, char **argv) {
   if (argc < 4) {
-    cout << "usage: ./BasicIntersectionServer input nElems nBits [port]" << endl;
+    cout << "usage: ./SetDiffServer input nElems nBits [port [chunkSize]]" << endl;
     return 1;
   }
 
@@ -54,6 +62,10 @@ int main(int argc, char **argv) {
   if (argc > 4) {
     port = atoi(argv[4]);
   }
+  uint32_t chunkSize = 0;
+  if (argc > 5) {
+    chunkSize = atoi(argv[5]);
+  }
 
   byte* input = new byte[nElems * (nBits + 1)];
   if (!ReadInputFile(input, inputFile, nElems * (nBits + 1))) {
@@ -63,7 +75,7 @@ int main(int argc, char **argv) {
 
   ServerLog("finished reading input");
   
-  SetDiffArgs args(nElems, nBits);
+  SetDiffArgs args(nElems, nBits, chunkSize);
   StartServer(port, input, &args, RunProtocol);
 
   delete[] input;
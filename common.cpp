@@ -17,104 +17,382 @@
  */
 
 #include "common.h"
+#include "GC/include/gates.h"
 
+#include <errno.h>
+#include <functional>
+#include <malloc.h>
 #include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
 
-static const uint64_t MAX_OT_BATCH = 15000000;
+// Client input wires go through OT in batches of this many, and the server
+// garbles with the labels of each batch as soon as it is done.
+static const uint64_t MAX_OT_BATCH = 1 << 20;
 static const int TIMEOUT_MS = 10000;
 
-void CreateArgMaxCircuit(GarbledCircuit& circuit, int nElems, int nBits) {
-  uint32_t nInputWires = nElems * 2 * nBits;
-  uint32_t nOutputWires = nElems + nBits;
+// The server sends a random token on the first connection, and accepts as
+// the table connection only a connection that sends the token back, so that
+// the two connections of a client are paired even if other clients connect
+// to the port in between. It gives up after this many other connections.
+static const int PAIRING_TOKEN_BYTES = 16;
+static const int MAX_UNPAIRED_CONNECTIONS = 16;
 
+// Builds a circuit with no gates whose n outputs are its n inputs. It is
+// used as the rest of a circuit that consists of a replicated stage only.
+static void CreateIdentityCircuit(GarbledCircuit& circuit, int n) {
   GarblingContext garblingContext;
 
-  int* inputs = new int[nInputWires];
-  countToN(inputs, nInputWires);
-  int* outputs = new int[nOutputWires];
-
-  // rough estimates for number of gates and wires in circuit
-  uint32_t nGates = 15 * nElems * nBits;
-  uint32_t nWires = 18 * nElems * nBits;
+  int* outputs = new int[n];
+  countToN(outputs, n);
 
-  createEmptyGarbledCircuit(&circuit, nInputWires, nOutputWires, nGates, nWires);
+  createEmptyGarbledCircuit(&circuit, n, n, 0, n);
   startBuilding(&circuit, &garblingContext);
-  ARGMAXVecSharedCircuit(&circuit, &garblingContext, nBits, nInputWires, inputs, outputs);
   finishBuilding(&circuit, &garblingContext, outputs);
 
-  delete[] inputs;
   delete[] outputs;
 }
 
-void CreateBasicIntersectionCircuit(GarbledCircuit& circuit, int nElems) {
-  uint32_t nInputWires = nElems * 2;
-  uint32_t nOutputWires = nElems;
+// The element-wise part of each circuit below (the additions, comparisons
+// and ANDs on a single element) is built once, for a single element, and
+// added as a replicated stage in front of the part that combines the
+// elements. The input layout of the circuit is that of the corresponding
+// *VecSharedCircuit.
+
+static void BuildArgMaxCircuit(GarbledCircuit& circuit, int nElems, int nBits, ArgMaxCircuitType type,
+                               CircuitShape shape) {
+  uint32_t nInputWires = nElems * 2 * nBits;
+  uint32_t nOutputWires = ArgMaxOutputWires(nElems, nBits, type);
+  int split = nInputWires / 2;
 
   GarblingContext garblingContext;
 
-  int* inputs = new int[nInputWires];
-  countToN(inputs, nInputWires);
+  // one ADD per element, on the two shares of the element
+  GarbledCircuit instance;
+  int* instanceInputs = new int[2 * nBits];
+  countToN(instanceInputs, 2 * nBits);
+  int* instanceOutputs = new int[nBits];
+
+  createEmptyGarbledCircuit(&instance, 2 * nBits, nBits, 0, 0);
+  startBuilding(&instance, &garblingContext);
+  ADDCircuit(&instance, &garblingContext, 2 * nBits, instanceInputs, instanceOutputs, shape);
+  finishBuilding(&instance, &garblingContext, instanceOutputs);
+
+  int* inputOffsets = new int[2 * nBits];
+  int* inputStrides = new int[2 * nBits];
+  int* outputOffsets = new int[nBits];
+  int* outputStrides = new int[nBits];
+  for (int j = 0; j < nBits; j++) {
+    inputOffsets[j] = j;
+    inputOffsets[nBits + j] = split + j;
+    inputStrides[j] = inputStrides[nBits + j] = nBits;
+    outputOffsets[j] = j;
+    outputStrides[j] = nBits;
+  }
+
+  // ARGMAX over the sums
+  int* inputs = new int[split];
+  countToN(inputs, split);
   int* outputs = new int[nOutputWires];
 
-  // one AND gate for each element (3 wires each : 2 input wires, 1 output wire)
-  uint32_t nGates = nElems;
-  uint32_t nWires = 3 * nElems;
+  auto buildBody = [&]() {
+    if (type == ARGMAX_TREE) {
+      ARGMAXVecTreeCircuit(&circuit, &garblingContext, nBits, split, inputs, outputs, shape);
+    } else if (type == ARGMAX_INDEX) {
+      ARGMAXIndexVecCircuit(&circuit, &garblingContext, nBits, split, inputs, outputs, shape);
+    } else {
+      ARGMAXVecCircuit(&circuit, &garblingContext, nBits, split, inputs, outputs, shape);
+    }
+  };
+
+  // count the gates first, so that the circuit is allocated at its exact size
+  createEmptyGarbledCircuit(&circuit, split, nOutputWires, 0, 0);
+  startDryRun(&circuit, &garblingContext);
+  buildBody();
+  finishDryRun(&circuit, &garblingContext);
 
-  createEmptyGarbledCircuit(&circuit, nInputWires, nOutputWires, nGates, nWires);
   startBuilding(&circuit, &garblingContext);
-  ANDCircuit(&circuit, &garblingContext, nInputWires, inputs, outputs);
+  buildBody();
   finishBuilding(&circuit, &garblingContext, outputs);
 
+  addReplicatedStage(&circuit, &instance, nElems, nInputWires,
+                     inputOffsets, inputStrides, outputOffsets, outputStrides);
+
+  delete[] instanceInputs;
+  delete[] instanceOutputs;
+  delete[] inputOffsets;
+  delete[] inputStrides;
+  delete[] outputOffsets;
+  delete[] outputStrides;
   delete[] inputs;
   delete[] outputs;
 }
 
-void CreateSetDiffCircuit(GarbledCircuit& circuit, int nElems, int nBits) {
-  uint32_t nInputWires = nElems * (2 * nBits + 2);
-  uint32_t nOutputWires = nElems;
+// The circuit for one chunk of nChunkElems elements of a chunked ARGMAX.
+// Its inputs are the client's shares of the elements of the chunk, then the
+// state carried over from the previous chunk, then the server's shares, and
+// its outputs are the state after the chunk. The state is the index (in
+// nIndexBits bits) and the value of the max so far, as in the outputs of
+// ARGMAXIndexVecCircuit, followed by the index of the first element of the
+// next chunk. It is all zeros before the first chunk. The max of the chunk
+// replaces the max so far only if it is strictly larger, so that the index
+// is that of the first element that attains the max, as in the unchunked
+// circuit.
+static void BuildArgMaxChunkCircuit(GarbledCircuit& circuit, int nChunkElems, int nBits, int nIndexBits,
+                                    CircuitShape shape) {
+  int nShares = nChunkElems * nBits;
+  int nStateWires = 2 * nIndexBits + nBits;
+  int nLocalIndexBits = ArgMaxIndexBits(nChunkElems);
+  int l = nIndexBits + nBits;
 
   GarblingContext garblingContext;
 
-  int* inputs = new int[nInputWires];
-  countToN(inputs, nInputWires);
-  int* outputs = new int[nOutputWires];
+  int* shares = new int[2 * nShares];
+  for (int i = 0; i < nShares; i++) {
+    shares[i] = i;
+    shares[nShares + i] = nShares + nStateWires + i;
+  }
+  int* state = new int[nStateWires];
+  for (int i = 0; i < nStateWires; i++) {
+    state[i] = nShares + i;
+  }
+  int* base = state + l;
+
+  int* local = new int[nLocalIndexBits + nBits];
+  int* addInputs = new int[2 * nIndexBits];
+  int* cmpInputs = new int[2 * nBits];
+  int* muxInputs = new int[2 * l + 1];
+  int* outputs = new int[nStateWires];
+
+  auto buildBody = [&]() {
+    ARGMAXIndexVecSharedCircuit(&circuit, &garblingContext, nBits, 2 * nShares, shares, local, shape);
+
+    // the max so far against the max of the chunk, at base plus its index
+    // within the chunk
+    memcpy(muxInputs, state, sizeof(int) * l);
+    if (nIndexBits > 0) {
+      memcpy(addInputs, base, sizeof(int) * nIndexBits);
+      for (int i = 0; i < nIndexBits; i++) {
+        addInputs[nIndexBits + i] = (i < nLocalIndexBits) ? local[i] : fixedZeroWire(&circuit, &garblingContext);
+      }
+      ADDCircuit(&circuit, &garblingContext, 2 * nIndexBits, addInputs, muxInputs + l, shape);
+    }
+    memcpy(muxInputs + l + nIndexBits, local + nLocalIndexBits, sizeof(int) * nBits);
+
+    memcpy(cmpInputs, local + nLocalIndexBits, sizeof(int) * nBits);
+    memcpy(cmpInputs + nBits, state + nIndexBits, sizeof(int) * nBits);
+    CMPCircuit(&circuit, &garblingContext, 2 * nBits, cmpInputs, &muxInputs[2 * l], shape);
+    MUXCircuit(&circuit, &garblingContext, 2 * l + 1, muxInputs, outputs);
+
+    // the next chunk starts nChunkElems elements later
+    if (nIndexBits > 0) {
+      memcpy(addInputs, base, sizeof(int) * nIndexBits);
+      for (int i = 0; i < nIndexBits; i++) {
+        addInputs[nIndexBits + i] = ((nChunkElems >> i) & 1) ? fixedOneWire(&circuit, &garblingContext)
+                                                               : fixedZeroWire(&circuit, &garblingContext);
+      }
+      ADDCircuit(&circuit, &garblingContext, 2 * nIndexBits, addInputs, outputs + l, shape);
+    }
+  };
 
-  // number of gates and wires in circuit
-  uint32_t nGates = (8 * nBits - 1) * nElems;
-  uint32_t nWires = (11 * nBits + 2) * nElems + 1;
+  createEmptyGarbledCircuit(&circuit, 2 * nShares + nStateWires, nStateWires, 0, 0);
+  startDryRun(&circuit, &garblingContext);
+  buildBody();
+  finishDryRun(&circuit, &garblingContext);
 
-  createEmptyGarbledCircuit(&circuit, nInputWires, nOutputWires, nGates, nWires);
   startBuilding(&circuit, &garblingContext);
-  SetDiffVecSharedCircuit(&circuit, &garblingContext, nBits, nInputWires, inputs, outputs);
+  buildBody();
   finishBuilding(&circuit, &garblingContext, outputs);
 
-  delete[] inputs;
+  delete[] shares;
+  delete[] state;
+  delete[] local;
+  delete[] addInputs;
+  delete[] cmpInputs;
+  delete[] muxInputs;
   delete[] outputs;
 }
 
-bool Listen(CSocket* socket, int port) {
-  if (!socket->Socket()) {
+static void BuildBasicIntersectionCircuit(GarbledCircuit& circuit, int nElems) {
+  uint32_t nInputWires = nElems * 2;
+
+  GarblingContext garblingContext;
+
+  // one AND gate per element (3 wires : 2 input wires, 1 output wire)
+  GarbledCircuit instance;
+  int instanceInputs[2] = {0, 1};
+  int instanceOutput;
+
+  createEmptyGarbledCircuit(&instance, 2, 1, 1, 3);
+  startBuilding(&instance, &garblingContext);
+  ANDCircuit(&instance, &garblingContext, 2, instanceInputs, &instanceOutput);
+  finishBuilding(&instance, &garblingContext, &instanceOutput);
+
+  int inputOffsets[2] = {0, nElems};
+  int inputStrides[2] = {1, 1};
+  int outputOffsets[1] = {0};
+  int outputStrides[1] = {1};
+
+  CreateIdentityCircuit(circuit, nElems);
+  addReplicatedStage(&circuit, &instance, nElems, nInputWires,
+                     inputOffsets, inputStrides, outputOffsets, outputStrides);
+}
+
+static void BuildSetDiffCircuit(GarbledCircuit& circuit, int nElems, int nBits) {
+  uint32_t nInputWires = nElems * (2 * nBits + 2);
+  int split = nInputWires / 2;
+  int nInstanceInputs = 2 * nBits + 2;
+
+  GarblingContext garblingContext;
+
+  GarbledCircuit instance;
+  int* instanceInputs = new int[nInstanceInputs];
+  countToN(instanceInputs, nInstanceInputs);
+  int instanceOutput;
+
+  createEmptyGarbledCircuit(&instance, nInstanceInputs, 1, 0, 0);
+  startBuilding(&instance, &garblingContext);
+  SetDiffVecSharedCircuit(&instance, &garblingContext, nBits, nInstanceInputs, instanceInputs, &instanceOutput);
+  finishBuilding(&instance, &garblingContext, &instanceOutput);
+
+  // the instance takes the bits and the flag of one element from each party
+  int* inputOffsets = new int[nInstanceInputs];
+  int* inputStrides = new int[nInstanceInputs];
+  for (int j = 0; j < nBits; j++) {
+    inputOffsets[j] = j;
+    inputOffsets[nBits + 1 + j] = split + j;
+    inputStrides[j] = inputStrides[nBits + 1 + j] = nBits;
+  }
+  inputOffsets[nBits] = nElems * nBits;
+  inputOffsets[2 * nBits + 1] = split + nElems * nBits;
+  inputStrides[nBits] = inputStrides[2 * nBits + 1] = 1;
+  int outputOffsets[1] = {0};
+  int outputStrides[1] = {1};
+
+  CreateIdentityCircuit(circuit, nElems);
+  addReplicatedStage(&circuit, &instance, nElems, nInputWires,
+                     inputOffsets, inputStrides, outputOffsets, outputStrides);
+
+  delete[] instanceInputs;
+  delete[] inputOffsets;
+  delete[] inputStrides;
+}
+
+// Loads the circuit stored under key from the cache directory, or builds it
+// with build and stores it there for the next run. The cache is best-effort:
+// if the directory cannot be created or written, the circuit is just built.
+static void CreateCachedCircuit(GarbledCircuit& circuit, const string& key,
+                                const function<void(GarbledCircuit&)>& build) {
+  string filename = string(CIRCUIT_CACHE_DIR) + "/" + key + ".circuit";
+  if (loadCircuit(&circuit, filename.c_str(), key.c_str())) {
+    return;
+  }
+
+  build(circuit);
+  if (mkdir(CIRCUIT_CACHE_DIR, 0755) == 0 || errno == EEXIST) {
+    saveCircuit(&circuit, filename.c_str(), key.c_str());
+  }
+}
+
+int ArgMaxIndexBits(int nElems) {
+  int nIndexBits = 0;
+  while ((1 << nIndexBits) < nElems) {
+    nIndexBits++;
+  }
+  return nIndexBits;
+}
+
+int ArgMaxOutputWires(int nElems, int nBits, ArgMaxCircuitType type) {
+  if (type == ARGMAX_INDEX) {
+    return ArgMaxIndexBits(nElems) + nBits;
+  }
+  return nElems + nBits;
+}
+
+// Circuits of the default SHAPE_CHAIN keep the cache keys they had before
+// the shape was selectable.
+static const char* ShapeKeySuffix(CircuitShape shape) {
+  static const char* suffixes[] = { "", "_bk", "_sk" };
+  return suffixes[shape];
+}
+
+void CreateArgMaxCircuit(GarbledCircuit& circuit, int nElems, int nBits, ArgMaxCircuitType type, CircuitShape shape) {
+  static const char* prefixes[] = { "argmax_", "argmax_tree_", "argmax_index_" };
+  stringstream key;
+  key << prefixes[type] << nElems << "_" << nBits << ShapeKeySuffix(shape);
+  CreateCachedCircuit(circuit, key.str(), [=](GarbledCircuit& c) { BuildArgMaxCircuit(c, nElems, nBits, type, shape); });
+}
+
+static void CreateArgMaxChunkCircuit(GarbledCircuit& circuit, int nChunkElems, int nBits, int nIndexBits,
+                                     CircuitShape shape) {
+  stringstream key;
+  key << "argmax_chunk_" << nChunkElems << "_" << nBits << "_" << nIndexBits << ShapeKeySuffix(shape);
+  CreateCachedCircuit(circuit, key.str(), [=](GarbledCircuit& c) {
+    BuildArgMaxChunkCircuit(c, nChunkElems, nBits, nIndexBits, shape);
+  });
+}
+
+void CreateBasicIntersectionCircuit(GarbledCircuit& circuit, int nElems) {
+  stringstream key;
+  key << "intersection_" << nElems;
+  CreateCachedCircuit(circuit, key.str(), [=](GarbledCircuit& c) { BuildBasicIntersectionCircuit(c, nElems); });
+}
+
+void CreateSetDiffCircuit(GarbledCircuit& circuit, int nElems, int nBits) {
+  stringstream key;
+  key << "setdiff_" << nElems << "_" << nBits;
+  CreateCachedCircuit(circuit, key.str(), [=](GarbledCircuit& c) { BuildSetDiffCircuit(c, nElems, nBits); });
+}
+
+bool Listen(Connection* connection, int port) {
+  CSocket listener;
+  if (!listener.Socket()) {
     return false;
   }
 
-  if (!socket->Bind((uint16_t) port)) {
+  if (!listener.Bind((uint16_t) port)) {
     return false;
   }
 
-  if (!socket->Listen()) {
+  if (!listener.Listen()) {
     return false;
   }
 
-  CSocket sock;
-  if (!socket->Accept(sock)) {
+  if (!listener.Accept(connection->socket)) {
+    listener.Close();
     return false;
   }
 
-  socket->AttachFrom(sock);
-  sock.Detach();
+  byte token[PAIRING_TOKEN_BYTES];
+  if (!GetRandomSeed(token, PAIRING_TOKEN_BYTES) ||
+      connection->socket.Send(token, PAIRING_TOKEN_BYTES) != PAIRING_TOKEN_BYTES) {
+    listener.Close();
+    return false;
+  }
+
+  bool paired = false;
+  for (int i = 0; i < MAX_UNPAIRED_CONNECTIONS && !paired; i++) {
+    if (!listener.Accept(connection->tableSocket)) {
+      break;
+    }
+    byte received[PAIRING_TOKEN_BYTES];
+    paired = connection->tableSocket.Receive(received, PAIRING_TOKEN_BYTES) == PAIRING_TOKEN_BYTES &&
+             memcmp(received, token, PAIRING_TOKEN_BYTES) == 0;
+    if (!paired) {
+      connection->tableSocket.Close();
+    }
+  }
+  listener.Close();
+
+  // the token is not part of the protocol's traffic
+  connection->socket.ResetStats();
+  connection->tableSocket.ResetStats();
+
+  return paired;
 }
 
-bool Connect(CSocket* socket, const char* address, int port) {
+static bool ConnectSocket(CSocket* socket, const char* address, int port) {
   for (int i = 0; i < RETRY_CONNECT; i++) {
     if (!socket->Socket()) {
       return false;
@@ -128,41 +406,64 @@ bool Connect(CSocket* socket, const char* address, int port) {
   return false;
 }
 
+bool Connect(Connection* connection, const char* address, int port) {
+  if (!ConnectSocket(&connection->socket, address, port)) {
+    return false;
+  }
+
+  // pair the table connection with this one (see Listen)
+  byte token[PAIRING_TOKEN_BYTES];
+  if (connection->socket.Receive(token, PAIRING_TOKEN_BYTES) != PAIRING_TOKEN_BYTES ||
+      !ConnectSocket(&connection->tableSocket, address, port) ||
+      connection->tableSocket.Send(token, PAIRING_TOKEN_BYTES) != PAIRING_TOKEN_BYTES) {
+    return false;
+  }
+
+  connection->socket.ResetStats();
+  connection->tableSocket.ResetStats();
+
+  return true;
+}
+
 void StartServer(int port, byte* input, void* args,
-                 void (*RunProtocol)(CSocket*, byte*, void*)) {
-  CSocket* socket = new CSocket();
-  if (Listen(socket, port)) {
+                 void (*RunProtocol)(Connection*, byte*, void*)) {
+  Connection* connection = new Connection();
+  if (Listen(connection, port)) {
     ServerLog("accepted connection from client");
   } else {
     stringstream ss;
     ss << "failed to listen for client connections on port " << port;
     ServerLog(ss.str());
+    delete connection;
     return;
   }
 
-  RunProtocol(socket, input, args);
-  socket->Close();
+  RunProtocol(connection, input, args);
+  connection->tableSocket.Close();
+  connection->socket.Close();
 
-  delete socket;
+  delete connection;
 }
 
 void StartClient(const char *address, int port, byte* input, void* args,
-                 void (*RunProtocol)(CSocket*, byte*, void*)) {
-  CSocket *socket = new CSocket();
-  if (Connect(socket, address, port)) {
+                 void (*RunProtocol)(Connection*, byte*, void*)) {
+  Connection *connection = new Connection();
+  if (Connect(connection, address, port)) {
     ClientLog("successfully connected to server");
   } else {
     stringstream ss;
     ss << "unable to connect to port " << port << " on address" << address;
     ClientLog(ss.str());
+    delete connection;
     return;
   }
 
-  RunProtocol(socket, input, args);
+  RunProtocol(connection, input, args);
 
-  socket->Close();
+  connection->tableSocket.Close();
+  connection->socket.Close();
 
-  delete socket;
+  delete connection;
 }
 
 void CreateChoiceVec(CBitVector& choices, byte* input, uint64_t len) {
@@ -186,24 +487,13 @@ void CreateChoiceVec(CBitVector& choices, byte* input, uint64_t len) {
   }
 }
 
-uint32_t RunServerProtocol(CSocket* socket, GarbledCircuit& circuit, byte* input, 
-                           uint32_t nInputWires, uint32_t nServerInputWires) {
-  uint32_t nClientInputWires = nInputWires - nServerInputWires;
-
-  // run server OT protocol
-  CBitVector zeroLabelsVec;
-  CBitVector oneLabelsVec;
-  CBitVector delta;
-
-  block* zeroLabels = new block[nClientInputWires];
-  block* oneLabels  = new block[nClientInputWires];
-
-  // choose a random offset (last bit of offset is 1 for point-and-permute)
-  // between the 0-labels and 1-labels to support free XORs
+// Chooses a random offset R between the 0-labels and 1-labels to support
+// free XORs (its last bit is 1 for point-and-permute), and sets delta so
+// that correlated OT gives every 1-label as the 0-label XOR R.
+static bool CreateOffset(CBitVector& delta, block* R) {
   byte offset[128];
   if (!GetRandomSeed(offset, 128)) {
-    ServerLog("OT failed");
-    return 0;
+    return false;
   }
 
   int ctr = 0;
@@ -211,114 +501,894 @@ uint32_t RunServerProtocol(CSocket* socket, GarbledCircuit& circuit, byte* input
   block* tmp = (block*)(delta.GetArr());
   block mask = makeBlock((uint64_t) 0, (uint64_t) 1);
   *tmp |= mask;
+  *R = *tmp;
 
-  // run server OT (in batches)
-  OTServer otServer;
-  otServer.InitOTSender(socket);
+  return true;
+}
 
-  uint64_t batchesNeeded = (nClientInputWires + MAX_OT_BATCH - 1) / MAX_OT_BATCH;
-  for (int i = 0; i < batchesNeeded; i++) {
-    uint64_t batchSize = MAX_OT_BATCH;
-    if (i == batchesNeeded - 1) {
-      batchSize = nClientInputWires % MAX_OT_BATCH;
-      if (batchSize == 0) {
-        batchSize = MAX_OT_BATCH;
-      }
-    }
+// Runs the server's side of OT for n client input wires, in batches of at
+// most MAX_OT_BATCH, and writes their 0-labels to zeroLabels. batchDone(k)
+// is called once the first k labels are written. Returns false if a batch
+// does not have the correlation R.
+static bool SendInputLabels(OTServer& otServer, CBitVector& delta, block R, block* zeroLabels, uint64_t n,
+                            const function<void(uint64_t)>& batchDone) {
+  CBitVector zeroLabelsVec;
+  CBitVector oneLabelsVec;
+
+  for (uint64_t first = 0; first < n; first += MAX_OT_BATCH) {
+    uint64_t batchSize = min(MAX_OT_BATCH, n - first);
 
     otServer.ObliviouslySend(zeroLabelsVec, oneLabelsVec, delta, batchSize);
-    memcpy(zeroLabels + i * MAX_OT_BATCH, zeroLabelsVec.GetArr(), batchSize * sizeof(block));
-    memcpy(oneLabels + i * MAX_OT_BATCH, oneLabelsVec.GetArr(), batchSize * sizeof(block));
+    block* batchZeroLabels = (block*) zeroLabelsVec.GetArr();
+    block* batchOneLabels = (block*) oneLabelsVec.GetArr();
+    block batchR = batchZeroLabels[0] ^ batchOneLabels[0];
+    bool correlated = BlockEqual(batchR, R);
 
+    memcpy(zeroLabels + first, batchZeroLabels, batchSize * sizeof(block));
     zeroLabelsVec.delCBitVector();
     oneLabelsVec.delCBitVector();
+    if (!correlated) {
+      return false;
+    }
+    batchDone(first + batchSize);
   }
 
-  cout << "OT bytes sent: " << socket->GetBytesSent() << endl;
-  cout << "OT bytes received: " << socket->GetBytesReceived() << endl;
-  ServerLog("finished OT for input wires");
-  
-  // garbled circuit evaluation
-  InputLabels allInputLabels = new block[2*nInputWires];
+  return true;
+}
+
+// Runs the client's side of OT for the n input bits in input, in batches of
+// at most MAX_OT_BATCH, and writes the labels it receives to labels.
+static void ReceiveInputLabels(OTClient& otClient, byte* input, block* labels, uint64_t n) {
+  for (uint64_t first = 0; first < n; first += MAX_OT_BATCH) {
+    uint64_t batchSize = min(MAX_OT_BATCH, n - first);
+
+    CBitVector choices;
+    CreateChoiceVec(choices, input + first, batchSize);
+
+    otClient.ObliviouslyReceive((byte*) (labels + first), choices, batchSize);
+  }
+}
+
+// The server garbles on its own thread while OT runs. Its offset R is the
+// OT correlation, so it is known up front, and the labels of each OT batch
+// are published to the garbler as soon as the batch is done. The garbler
+// sends the keys and then the tables on the table socket as they are
+// produced, and once OT is done, the client evaluates the tables as they
+// arrive. Neither side holds all of the tables at once.
+uint32_t RunServerProtocol(Connection* connection, GarbledCircuit& circuit, byte* input,
+                           uint32_t nInputWires, uint32_t nServerInputWires) {
+  CSocket* socket = &connection->socket;
+  uint32_t nClientInputWires = nInputWires - nServerInputWires;
+
+  // run server OT protocol
+  CBitVector delta;
+  block R;
+  if (!CreateOffset(delta, &R)) {
+    ServerLog("OT failed");
+    return 0;
+  }
+
+  // Only the 0-labels of the client's wires are kept, since they come out of
+  // OT and cannot be derived. Every other label is derived from them, R and
+  // a seed when garbling needs it (see InputLabelSource).
+  block* zeroLabels = new block[nClientInputWires];
+
+  // garbled circuit evaluation, on the labels of each OT batch once it is
+  // done
   OutputMap outputMap = new block[2 * circuit.m];
 
-  for (int i = 0; i < nClientInputWires; i++) {
-    allInputLabels[2*i] = zeroLabels[i];
-    allInputLabels[2*i + 1] = oneLabels[i];
+  InputLabelProgress progress;
+  InputLabelSource labelSource;
+  createInputLabelSource(&labelSource, zeroLabels, nClientInputWires, R);
+  labelSource.progress = &progress;
+
+  CSocket* tableSocket = &connection->tableSocket;
+  thread garbler([&] {
+    // only AND gates have tables
+    tableSocket->Send(&circuit.nAndGates, sizeof(circuit.nAndGates));
+
+    // the client needs the keys before the first table
+    bool sentKeys = false;
+    auto sendKeys = [&]() {
+      if (!sentKeys) {
+        tableSocket->Send(&circuit.fixedWiresSeed, sizeof(circuit.fixedWiresSeed));
+        tableSocket->Send(&circuit.globalKey, sizeof(circuit.globalKey));
+        sentKeys = true;
+      }
+    };
+    garbleCircuit(&circuit, &labelSource, outputMap, [&](const GarbledTable *tables, int count) {
+      sendKeys();
+      tableSocket->SendLarge((byte*) tables, count * sizeof(GarbledTable));
+    });
+    sendKeys();
+  });
+
+  // run server OT (in batches)
+  OTServer otServer;
+  otServer.InitOTSender(socket);
+
+  bool otFailed = !SendInputLabels(otServer, delta, R, zeroLabels, nClientInputWires,
+                                   [&](uint64_t nDone) { progress.publish(nDone); });
+
+  if (otFailed) {
+    // the garbler must not wait for labels that will never come
+    progress.publish(nClientInputWires);
+    garbler.join();
+
+    ServerLog("OT failed");
+    delete[] zeroLabels;
+    delete[] outputMap;
+    return 0;
   }
 
-  block R = zeroLabels[0] ^ oneLabels[0];
-  createInputLabels(allInputLabels + nClientInputWires * 2, nServerInputWires, R);
-  garbleCircuit(&circuit, allInputLabels, outputMap);
+  cout << "OT bytes sent: " << socket->GetBytesSent() << endl;
+  cout << "OT bytes received: " << socket->GetBytesReceived() << endl;
+  ServerLog("finished OT for input wires");
 
+  // The server's labels come from the seed, so they are sent while the
+  // garbler is still running, and the client can start evaluating.
   InputLabels inputLabels = new block[nServerInputWires];
-  extractLabels(inputLabels, allInputLabels + 2 * nClientInputWires, input, nServerInputWires);
-
-  // send garbled circuit and garbled inputs
+  extractLabels(inputLabels, &labelSource, input, nClientInputWires, nServerInputWires);
   socket->SendLarge((byte*) inputLabels, nServerInputWires * sizeof(block));
+
+  garbler.join();
   socket->SendLarge((byte*) outputMap, 2 * circuit.m * sizeof(block));
-  socket->SendLarge((byte*) circuit.garbledTable, circuit.q * sizeof(GarbledTable));
-  socket->Send(&circuit.nAndGates, sizeof(circuit.nAndGates));
-  socket->Send(&circuit.fixedWiresSeed, sizeof(circuit.fixedWiresSeed));
-  socket->Send(&circuit.globalKey, sizeof(circuit.globalKey));
 
-  cout << endl << "bytes sent: " << socket->GetBytesSent() << endl;
-  cout << "bytes received: " << socket->GetBytesReceived() << endl;
+  cout << endl << "bytes sent: " << socket->GetBytesSent() + tableSocket->GetBytesSent() << endl;
+  cout << "bytes received: " << socket->GetBytesReceived() + tableSocket->GetBytesReceived() << endl;
 
   uint32_t finished = 0;
   socket->Receive(&finished, sizeof(finished));
 
   delete[] zeroLabels;
-  delete[] oneLabels;
-  delete[] allInputLabels;
   delete[] outputMap;
   delete[] inputLabels;
 
   return finished;
 }
 
-void RunClientProtocol(CSocket* socket, GarbledCircuit& circuit, byte* input, int* outputVals,
+// The client's garbled tables on their way from the receiver thread to the
+// evaluator, in windows of TABLE_WINDOW_SIZE tables, of which at most
+// TABLE_QUEUE_DEPTH + 1 exist at a time: the receiver reuses the windows
+// the evaluator is done with, so it waits once the evaluator falls that far
+// behind. The tables of every circuit start in a new window.
+class TableWindows {
+ public:
+  TableWindows()
+    : fullWindows(TABLE_QUEUE_DEPTH + 1), emptyWindows(TABLE_QUEUE_DEPTH + 1), nWindows(0),
+      window(NULL), windowUsed(0) { }
+
+  // Once both threads are done, every window is either the one the
+  // evaluator still holds or empty.
+  ~TableWindows() {
+    if (window != NULL) {
+      free(window);
+      nWindows--;
+    }
+    for (int i = 0; i < nWindows; i++) {
+      free(emptyWindows.pop());
+    }
+  }
+
+  // Receives the nTables tables of a circuit from socket (on the receiver
+  // thread).
+  void receive(CSocket* socket, int nTables) {
+    for (int i = 0; i < nTables; i += TABLE_WINDOW_SIZE) {
+      GarbledTable* full;
+      if (nWindows < TABLE_QUEUE_DEPTH + 1) {
+        full = (GarbledTable*) memalign(128, sizeof(GarbledTable) * TABLE_WINDOW_SIZE);
+        if (full == NULL) {
+          ClientLog("memory allocation error");
+          exit(1);
+        }
+        nWindows++;
+      } else {
+        full = emptyWindows.pop();
+      }
+      int count = min(TABLE_WINDOW_SIZE, nTables - i);
+      socket->ReceiveLarge((byte*) full, count * sizeof(GarbledTable));
+      fullWindows.push(full);
+    }
+  }
+
+  // Marks the end of the tables (on the receiver thread), for a circuit
+  // whose number of tables is only known once they have all arrived, so
+  // that reading past them fails instead of waiting.
+  void finish() {
+    fullWindows.push(NULL);
+  }
+
+  // Copies the next count tables of the current circuit to tables (on the
+  // evaluator thread), as the TableSource of evaluate.
+  void read(GarbledTable* tables, int count) {
+    while (count > 0) {
+      if (window == NULL || windowUsed == TABLE_WINDOW_SIZE) {
+        releaseWindow();
+        window = fullWindows.pop();
+        if (window == NULL) {
+          ClientLog("garbled circuit does not match the local circuit");
+          exit(1);
+        }
+      }
+      int piece = min(count, TABLE_WINDOW_SIZE - windowUsed);
+      memcpy(tables, window + windowUsed, piece * sizeof(GarbledTable));
+      tables += piece;
+      count -= piece;
+      windowUsed += piece;
+    }
+  }
+
+  // Hands back the window being read (on the evaluator thread). The
+  // evaluator calls it once it has read all of the tables of a circuit, so
+  // that it reads those of the next one from a new window.
+  void releaseWindow() {
+    if (window != NULL) {
+      emptyWindows.push(window);
+      window = NULL;
+    }
+    windowUsed = 0;
+  }
+
+ private:
+  BoundedQueue<GarbledTable*> fullWindows, emptyWindows;
+  // only written by the receiver until the destructor
+  int nWindows;
+  // only used by the evaluator
+  GarbledTable* window;
+  int windowUsed;
+};
+
+void RunClientProtocol(Connection* connection, GarbledCircuit& circuit, byte* input, int* outputVals,
                        uint32_t nInputWires, uint32_t nClientInputWires, uint32_t nOutputWires) {
+  CSocket* socket = &connection->socket;
   uint32_t nServerInputWires = nInputWires - nClientInputWires;
 
   block* inputLabels = new block[nInputWires];
 
+  // receive the keys and the tables while OT runs
+  CSocket* tableSocket = &connection->tableSocket;
+  BoundedQueue<bool> keysReceived(1);
+  TableWindows windows;
+  thread tableReceiver([&] {
+    int nAndGates;
+    tableSocket->Receive(&nAndGates, sizeof(nAndGates));
+    if (nAndGates != circuit.nAndGates) {
+      ClientLog("garbled circuit does not match the local circuit");
+      exit(1);
+    }
+    tableSocket->Receive(&circuit.fixedWiresSeed, sizeof(circuit.fixedWiresSeed));
+    tableSocket->Receive(&circuit.globalKey, sizeof(circuit.globalKey));
+    keysReceived.push(true);
+
+    windows.receive(tableSocket, nAndGates);
+  });
+
   OTClient otClient;
   otClient.InitOTClient(socket);
 
-  uint64_t batchesNeeded = (nClientInputWires + MAX_OT_BATCH - 1) / MAX_OT_BATCH;
-  for (int i = 0; i < batchesNeeded; i++) {
-    uint64_t batchSize = MAX_OT_BATCH;
-    if (i == batchesNeeded - 1) {
-      batchSize = nClientInputWires % MAX_OT_BATCH;
-      if (batchSize == 0) {
-        batchSize = MAX_OT_BATCH;
+  ReceiveInputLabels(otClient, input, inputLabels, nClientInputWires);
+
+  ClientLog("finished OT for input wires");
+  cout << "OT bytes sent: " << socket->GetBytesSent() << endl;
+  cout << "OT bytes received: " << socket->GetBytesReceived() << endl;
+
+   // prepare garbled circuit
+  block *outputMap = new block[2 * nOutputWires];
+  block *computedOutputMap = new block[nOutputWires];
+
+  socket->ReceiveLarge((byte*) (inputLabels + nClientInputWires), nServerInputWires * sizeof(block));
+  keysReceived.pop();
+
+  // garbled circuit evaluation, on the windows as they arrive
+  evaluate(&circuit, inputLabels, computedOutputMap, [&](GarbledTable *tables, int count) {
+    windows.read(tables, count);
+  });
+  windows.releaseWindow();
+  tableReceiver.join();
+
+  socket->ReceiveLarge((byte*) outputMap, 2 * nOutputWires * sizeof(block));
+  mapOutputs(outputMap, computedOutputMap, outputVals, nOutputWires);
+
+  uint32_t finished = 1;
+  socket->Send(&finished, sizeof(finished));
+
+  delete[] inputLabels;
+  delete[] outputMap;
+  delete[] computedOutputMap;
+}
+
+ChunkedOp BasicIntersectionOp() {
+  return ChunkedOp(vector<int>(1, 1), 1, [](GarbledCircuit& circuit, int nElems) {
+    CreateBasicIntersectionCircuit(circuit, nElems);
+  });
+}
+
+ChunkedOp SetDiffOp(int nBits) {
+  // the bits of every element, then a flag for every element
+  vector<int> fieldBits;
+  fieldBits.push_back(nBits);
+  fieldBits.push_back(1);
+  return ChunkedOp(fieldBits, 1, [=](GarbledCircuit& circuit, int nElems) {
+    CreateSetDiffCircuit(circuit, nElems, nBits);
+  });
+}
+
+ChunkedOp ArgMaxOp(int nElems, int nBits, CircuitShape shape) {
+  int nIndexBits = ArgMaxIndexBits(nElems);
+  return ChunkedOp(vector<int>(1, nBits), 0, [=](GarbledCircuit& circuit, int nChunkElems) {
+    CreateArgMaxChunkCircuit(circuit, nChunkElems, nBits, nIndexBits, shape);
+  }, 2 * nIndexBits + nBits);
+}
+
+// Returns the number of input bits of each party for nElems elements.
+static uint32_t ChunkInputBits(const ChunkedOp& op, uint32_t nElems) {
+  uint32_t nBits = 0;
+  for (size_t f = 0; f < op.fieldBits.size(); f++) {
+    nBits += op.fieldBits[f] * nElems;
+  }
+  return nBits;
+}
+
+// Copies the slices of every field for elements [first, first + count) out
+// of a party's input for all nElems elements.
+static void GetChunkInput(const ChunkedOp& op, const byte* input, uint32_t nElems, uint32_t first,
+                          uint32_t count, byte* chunkInput) {
+  for (size_t f = 0; f < op.fieldBits.size(); f++) {
+    int bits = op.fieldBits[f];
+    memcpy(chunkInput, input + (uint64_t) first * bits, (uint64_t) count * bits);
+    input += (uint64_t) nElems * bits;
+    chunkInput += (uint64_t) count * bits;
+  }
+}
+
+// A chunk of elements on its way through the pipeline. labels holds the
+// client's input labels that come out of OT, followed by room for those of
+// the state (and on the client, the server's), and the rest is what the
+// server sends for it, except for its tables (see TableWindows).
+struct Chunk {
+  uint32_t first, count;
+  block* labels;
+  block* serverLabels;
+  block* outputMap;
+  block fixedWiresSeed, globalKey;
+
+  Chunk(uint32_t first, uint32_t count)
+    : first(first), count(count), labels(NULL), serverLabels(NULL), outputMap(NULL) { }
+  ~Chunk() {
+    delete[] labels;
+    delete[] serverLabels;
+    delete[] outputMap;
+  }
+};
+
+// The server runs OT for one chunk after another on socket, and a garbler
+// thread garbles each chunk once its labels are in and sends it on
+// tableSocket: the server's labels and the keys, then the tables as they
+// are garbled, then the output map. Every full chunk is garbled from the
+// same circuit, with fresh keys. The 0-labels of the state outputs of a
+// chunk are the 0-labels of the state inputs of the next one, and the
+// output map of a chunk with state is only sent for the last chunk.
+uint32_t RunChunkedServerProtocol(Connection* connection, const ChunkedOp& op, byte* input,
+                                  uint32_t nElems, uint32_t chunkSize) {
+  CSocket* socket = &connection->socket;
+  CSocket* tableSocket = &connection->tableSocket;
+  chunkSize = min(chunkSize, nElems);
+
+  CBitVector delta;
+  block R;
+  if (!CreateOffset(delta, &R)) {
+    ServerLog("OT failed");
+    return 0;
+  }
+
+  Circuit circuit, lastCircuit;
+  op.createCircuit(*circuit, chunkSize);
+  if (nElems % chunkSize != 0) {
+    op.createCircuit(*lastCircuit, nElems % chunkSize);
+  }
+
+  // a NULL chunk stops the garbler
+  BoundedQueue<Chunk*> otChunks(CHUNK_QUEUE_DEPTH);
+  thread garbler([&] {
+    tableSocket->Send(&circuit->nAndGates, sizeof(circuit->nAndGates));
+
+    // the 0-labels of the state after the last chunk
+    block* state = new block[op.stateBits];
+
+    Chunk* chunk;
+    while ((chunk = otChunks.pop()) != NULL) {
+      GarbledCircuit& chunkCircuit = (chunk->count == chunkSize) ? *circuit : *lastCircuit;
+      uint32_t nChunkInputWires = ChunkInputBits(op, chunk->count);
+      bool firstChunk = (chunk->first == 0);
+      bool lastChunk = (chunk->first + chunk->count == nElems);
+
+      // Before the first chunk, the state is the server's input and its
+      // labels come from the seed like those of the rest of the server's
+      // input. After that, they are stored right after the client's.
+      uint32_t nStored = nChunkInputWires;
+      if (!firstChunk) {
+        memcpy(chunk->labels + nChunkInputWires, state, op.stateBits * sizeof(block));
+        nStored += op.stateBits;
+      }
+
+      OutputMap outputMap = new block[2 * chunkCircuit.m];
+      InputLabelSource labelSource;
+      createInputLabelSource(&labelSource, chunk->labels, nStored, R);
+
+      // the labels of the inputs that are not stored, which the server
+      // supplies as a state of zeros followed by its input, and which come
+      // from the seed
+      byte* chunkInput = new byte[op.stateBits + nChunkInputWires];
+      memset(chunkInput, 0, op.stateBits);
+      GetChunkInput(op, input, nElems, chunk->first, chunk->count, chunkInput + op.stateBits);
+      uint32_t nServerLabels = chunkCircuit.n - nStored;
+      InputLabels inputLabels = new block[nServerLabels];
+      extractLabels(inputLabels, &labelSource, chunkInput + (nStored - nChunkInputWires), nStored, nServerLabels);
+      tableSocket->SendLarge((byte*) inputLabels, nServerLabels * sizeof(block));
+
+      // the client needs the keys before the first table
+      bool sentKeys = false;
+      auto sendKeys = [&]() {
+        if (!sentKeys) {
+          tableSocket->Send(&chunkCircuit.fixedWiresSeed, sizeof(chunkCircuit.fixedWiresSeed));
+          tableSocket->Send(&chunkCircuit.globalKey, sizeof(chunkCircuit.globalKey));
+          sentKeys = true;
+        }
+      };
+      garbleCircuit(&chunkCircuit, &labelSource, outputMap, [&](const GarbledTable *tables, int count) {
+        sendKeys();
+        tableSocket->SendLarge((byte*) tables, count * sizeof(GarbledTable));
+      });
+      sendKeys();
+      for (int i = 0; i < op.stateBits; i++) {
+        state[i] = outputMap[2 * i];
+      }
+
+      if (op.stateBits == 0 || lastChunk) {
+        tableSocket->SendLarge((byte*) outputMap, 2 * chunkCircuit.m * sizeof(block));
       }
+
+      delete[] outputMap;
+      delete[] chunkInput;
+      delete[] inputLabels;
+      delete chunk;
     }
 
-    CBitVector choices;
-    CreateChoiceVec(choices, input + i * MAX_OT_BATCH, batchSize);
+    delete[] state;
+  });
+
+  OTServer otServer;
+  otServer.InitOTSender(socket);
+
+  bool otFailed = false;
+  for (uint32_t first = 0; first < nElems && !otFailed; first += chunkSize) {
+    Chunk* chunk = new Chunk(first, min(chunkSize, nElems - first));
+    uint32_t nChunkInputWires = ChunkInputBits(op, chunk->count);
+    chunk->labels = new block[nChunkInputWires + op.stateBits];
+
+    otFailed = !SendInputLabels(otServer, delta, R, chunk->labels, nChunkInputWires, [](uint64_t) { });
+    if (otFailed) {
+      delete chunk;
+    } else {
+      otChunks.push(chunk);
+    }
+  }
+  otChunks.push(NULL);
+  garbler.join();
+
+  if (otFailed) {
+    ServerLog("OT failed");
+    return 0;
+  }
+  ServerLog("finished all chunks");
+
+  cout << endl << "bytes sent: " << socket->GetBytesSent() + tableSocket->GetBytesSent() << endl;
+  cout << "bytes received: " << socket->GetBytesReceived() + tableSocket->GetBytesReceived() << endl;
+
+  uint32_t finished = 0;
+  socket->Receive(&finished, sizeof(finished));
+
+  return finished;
+}
 
-    otClient.ObliviouslyReceive((byte*) (inputLabels + i * MAX_OT_BATCH), choices, batchSize);
+// The client runs OT for one chunk after another on socket, while a
+// receiver thread reads the chunks the server sends on tableSocket and an
+// evaluator thread evaluates and decodes each chunk once its OT labels and
+// the server's labels and keys are in, on its tables as they arrive in
+// windows (see TableWindows). The labels of the state outputs of a chunk
+// become the labels of the state inputs of the next one.
+void RunChunkedClientProtocol(Connection* connection, const ChunkedOp& op, byte* input, int* outputVals,
+                              uint32_t nElems, uint32_t chunkSize, long* nAndGates,
+                              const ChunkResultCallback& onResults) {
+  CSocket* socket = &connection->socket;
+  CSocket* tableSocket = &connection->tableSocket;
+  chunkSize = min(chunkSize, nElems);
+
+  Circuit circuit, lastCircuit;
+  op.createCircuit(*circuit, chunkSize);
+  if (nElems % chunkSize != 0) {
+    op.createCircuit(*lastCircuit, nElems % chunkSize);
   }
 
+  BoundedQueue<Chunk*> otChunks(CHUNK_QUEUE_DEPTH);
+  BoundedQueue<Chunk*> receivedChunks(CHUNK_QUEUE_DEPTH);
+  BoundedQueue<block*> outputMaps(CHUNK_QUEUE_DEPTH);
+  TableWindows windows;
+
+  thread receiver([&] {
+    int nChunkAndGates;
+    tableSocket->Receive(&nChunkAndGates, sizeof(nChunkAndGates));
+    if (nChunkAndGates != circuit->nAndGates) {
+      ClientLog("garbled circuit does not match the local circuit");
+      exit(1);
+    }
+
+    for (uint32_t first = 0; first < nElems; first += chunkSize) {
+      Chunk* chunk = new Chunk(first, min(chunkSize, nElems - first));
+      GarbledCircuit& chunkCircuit = (chunk->count == chunkSize) ? *circuit : *lastCircuit;
+      uint32_t nChunkInputWires = ChunkInputBits(op, chunk->count);
+      uint32_t nServerLabels = nChunkInputWires + ((first == 0) ? op.stateBits : 0);
+
+      // the evaluator starts on the chunk once it has the labels and keys,
+      // and its tables follow through windows
+      chunk->serverLabels = new block[nServerLabels];
+      tableSocket->ReceiveLarge((byte*) chunk->serverLabels, nServerLabels * sizeof(block));
+      tableSocket->Receive(&chunk->fixedWiresSeed, sizeof(chunk->fixedWiresSeed));
+      tableSocket->Receive(&chunk->globalKey, sizeof(chunk->globalKey));
+      bool hasOutputMap = (op.stateBits == 0 || first + chunk->count == nElems);
+      receivedChunks.push(chunk);
+
+      windows.receive(tableSocket, chunkCircuit.nAndGates);
+
+      block* outputMap = NULL;
+      if (hasOutputMap) {
+        outputMap = new block[2 * chunkCircuit.m];
+        tableSocket->ReceiveLarge((byte*) outputMap, 2 * chunkCircuit.m * sizeof(block));
+      }
+      outputMaps.push(outputMap);
+    }
+  });
+
+  *nAndGates = 0;
+  thread evaluator([&] {
+    // the labels of the state after the last chunk
+    block* state = new block[op.stateBits];
+
+    for (uint32_t first = 0; first < nElems; first += chunkSize) {
+      Chunk* otChunk = otChunks.pop();
+      Chunk* chunk = receivedChunks.pop();
+      GarbledCircuit& chunkCircuit = (chunk->count == chunkSize) ? *circuit : *lastCircuit;
+      uint32_t nChunkInputWires = ChunkInputBits(op, chunk->count);
+
+      // the server sends the labels of the state before the first chunk
+      block* inputLabels = otChunk->labels;
+      uint32_t nServerLabels = nChunkInputWires;
+      if (first == 0) {
+        nServerLabels += op.stateBits;
+      } else {
+        memcpy(inputLabels + nChunkInputWires, state, op.stateBits * sizeof(block));
+      }
+      memcpy(inputLabels + chunkCircuit.n - nServerLabels, chunk->serverLabels, nServerLabels * sizeof(block));
+
+      chunkCircuit.fixedWiresSeed = chunk->fixedWiresSeed;
+      chunkCircuit.globalKey = chunk->globalKey;
+
+      block* computedOutputMap = new block[chunkCircuit.m];
+      evaluate(&chunkCircuit, inputLabels, computedOutputMap, [&](GarbledTable *tables, int count) {
+        windows.read(tables, count);
+      });
+      windows.releaseWindow();
+      chunk->outputMap = outputMaps.pop();
+
+      if (op.stateBits == 0) {
+        int* chunkOutputVals = (outputVals != NULL) ? outputVals + (uint64_t) first * op.outputBits
+                                                    : new int[chunkCircuit.m];
+        mapOutputs(chunk->outputMap, computedOutputMap, chunkOutputVals, chunkCircuit.m);
+        if (onResults) {
+          onResults(first, chunk->count, chunkOutputVals);
+        }
+        if (outputVals == NULL) {
+          delete[] chunkOutputVals;
+        }
+      } else if (chunk->outputMap != NULL) {
+        mapOutputs(chunk->outputMap, computedOutputMap, outputVals, chunkCircuit.m);
+      } else {
+        memcpy(state, computedOutputMap, op.stateBits * sizeof(block));
+      }
+      *nAndGates += chunkCircuit.nAndGates;
+
+      delete[] computedOutputMap;
+      delete otChunk;
+      delete chunk;
+    }
+
+    delete[] state;
+  });
+
+  OTClient otClient;
+  otClient.InitOTClient(socket);
+
+  for (uint32_t first = 0; first < nElems; first += chunkSize) {
+    Chunk* chunk = new Chunk(first, min(chunkSize, nElems - first));
+    uint32_t nChunkInputWires = ChunkInputBits(op, chunk->count);
+    chunk->labels = new block[2 * nChunkInputWires + op.stateBits];
+
+    byte* chunkInput = new byte[nChunkInputWires];
+    GetChunkInput(op, input, nElems, first, chunk->count, chunkInput);
+    ReceiveInputLabels(otClient, chunkInput, chunk->labels, nChunkInputWires);
+    delete[] chunkInput;
+
+    otChunks.push(chunk);
+  }
+
+  receiver.join();
+  evaluator.join();
+  ClientLog("finished all chunks");
+
+  uint32_t finished = 1;
+  socket->Send(&finished, sizeof(finished));
+}
+
+// As ARGMAXVecSharedCircuit on the shares of nElems elements, built into a
+// stream in three passes over the elements: the sums of the shares, which
+// stay resident (see GateStream::pin), the running max, and the comparison
+// of every sum with the max, whose outputs are handed over as they are
+// built. Every STREAM_BUFFER_SIZE gates or so, every other label but those
+// of the running max is dropped.
+static void BuildStreamedArgMax(GarbledCircuit* circuit, GarblingContext* context, GateStream* stream,
+                                int nElems, int nBits, CircuitShape shape) {
+  int split = nElems * nBits;
+
+  vector<int> sums(split);
+  vector<int> shares(2 * nBits);
+  long keptAt = stream->getNumGates();
+  int firstUnpinned = 0;
+  for (int i = 0; i < nElems; i++) {
+    for (int j = 0; j < nBits; j++) {
+      shares[j] = nBits * i + j;
+      shares[nBits + j] = split + nBits * i + j;
+    }
+    ADDCircuit(circuit, context, 2 * nBits, shares.data(), &sums[nBits * i], shape);
+    if (stream->getNumGates() - keptAt >= STREAM_BUFFER_SIZE || i == nElems - 1) {
+      stream->pin(&sums[firstUnpinned], nBits * (i + 1) - firstUnpinned);
+      stream->keepOnly(NULL, 0);
+      keptAt = stream->getNumGates();
+      firstUnpinned = nBits * (i + 1);
+    }
+  }
+
+  // the max so far, compared with the next element as in MAXVecCircuit
+  vector<int> maxWires(sums.begin(), sums.begin() + nBits);
+  vector<int> maxInputs(2 * nBits);
+  for (int i = 1; i < nElems; i++) {
+    copy(maxWires.begin(), maxWires.end(), maxInputs.begin());
+    copy(sums.begin() + nBits * i, sums.begin() + nBits * (i + 1), maxInputs.begin() + nBits);
+    MAXCircuit(circuit, context, 2 * nBits, maxInputs.data(), maxWires.data(), shape);
+    if (stream->getNumGates() - keptAt >= STREAM_BUFFER_SIZE) {
+      stream->keepOnly(maxWires.data(), nBits);
+      keptAt = stream->getNumGates();
+    }
+  }
+
+  // a bit for every element that attains the max, as in
+  // ARGMAXFromMaxCircuit
+  vector<int> eqInputs(2 * nBits);
+  copy(maxWires.begin(), maxWires.end(), eqInputs.begin() + nBits);
+  vector<int> outputs;
+  for (int i = 0; i < nElems; i++) {
+    copy(sums.begin() + nBits * i, sums.begin() + nBits * (i + 1), eqInputs.begin());
+    int eq;
+    EQCircuit(circuit, context, 2 * nBits, eqInputs.data(), &eq, shape);
+    outputs.push_back(eq);
+    if (stream->getNumGates() - keptAt >= STREAM_BUFFER_SIZE) {
+      stream->output(outputs.data(), outputs.size());
+      outputs.clear();
+      stream->keepOnly(maxWires.data(), nBits);
+      keptAt = stream->getNumGates();
+    }
+  }
+  stream->output(outputs.data(), outputs.size());
+  stream->output(maxWires.data(), nBits);
+}
+
+StreamedOp StreamedArgMaxOp(int nElems, int nBits, CircuitShape shape) {
+  return StreamedOp(2 * nElems * nBits, nElems + nBits,
+                    [=](GarbledCircuit* circuit, GarblingContext* context, GateStream* stream) {
+    BuildStreamedArgMax(circuit, context, stream, nElems, nBits, shape);
+  });
+}
+
+// Builds op into stream, on a circuit that only holds its inputs and
+// outputs.
+static void BuildStreamed(const StreamedOp& op, GateStream* stream) {
+  Circuit circuit;
+  createEmptyGarbledCircuit(circuit.get(), op.nInputWires, op.nOutputWires, 0, 0);
+
+  GarblingContext garblingContext;
+  startStreaming(circuit.get(), &garblingContext, stream);
+  op.build(circuit.get(), &garblingContext, stream);
+  stream->finish();
+}
+
+// As RunServerProtocol, but the garbler builds the circuit as it garbles it
+// (see GarblingStream), so neither its gates nor its tables are ever held.
+// It sends the tables on the table socket in frames of TABLE_WINDOW_SIZE
+// tables, each preceded by its size, and ends them with an empty frame.
+uint32_t RunStreamedServerProtocol(Connection* connection, const StreamedOp& op, byte* input,
+                                   uint32_t nServerInputWires) {
+  CSocket* socket = &connection->socket;
+  uint32_t nInputWires = op.nInputWires;
+  uint32_t nOutputWires = op.nOutputWires;
+  uint32_t nClientInputWires = nInputWires - nServerInputWires;
+
+  CBitVector delta;
+  block R;
+  if (!CreateOffset(delta, &R)) {
+    ServerLog("OT failed");
+    return 0;
+  }
+
+  block* zeroLabels = new block[nClientInputWires];
+  OutputMap outputMap = new block[2 * nOutputWires];
+
+  InputLabelProgress progress;
+  InputLabelSource labelSource;
+  createInputLabelSource(&labelSource, zeroLabels, nClientInputWires, R);
+  labelSource.progress = &progress;
+
+  CSocket* tableSocket = &connection->tableSocket;
+  thread garbler([&] {
+    GarbledTable* window = (GarbledTable*) memalign(128, sizeof(GarbledTable) * TABLE_WINDOW_SIZE);
+    if (window == NULL) {
+      ServerLog("memory allocation error");
+      exit(1);
+    }
+    int windowUsed = 0;
+    auto sendWindow = [&]() {
+      tableSocket->Send(&windowUsed, sizeof(windowUsed));
+      tableSocket->SendLarge((byte*) window, windowUsed * sizeof(GarbledTable));
+      windowUsed = 0;
+    };
+
+    GarblingStream stream(nInputWires, nOutputWires, &labelSource, outputMap,
+                          [&](const GarbledTable *tables, int count) {
+      while (count > 0) {
+        int piece = min(count, TABLE_WINDOW_SIZE - windowUsed);
+        memcpy(window + windowUsed, tables, piece * sizeof(GarbledTable));
+        tables += piece;
+        count -= piece;
+        windowUsed += piece;
+        if (windowUsed == TABLE_WINDOW_SIZE) {
+          sendWindow();
+        }
+      }
+    });
+
+    tableSocket->Send(&nInputWires, sizeof(nInputWires));
+    tableSocket->Send(&nOutputWires, sizeof(nOutputWires));
+    block fixedWiresSeed = stream.getFixedWiresSeed();
+    block globalKey = stream.getGlobalKey();
+    tableSocket->Send(&fixedWiresSeed, sizeof(fixedWiresSeed));
+    tableSocket->Send(&globalKey, sizeof(globalKey));
+
+    BuildStreamed(op, &stream);
+    if (windowUsed > 0) {
+      sendWindow();
+    }
+    sendWindow();
+
+    free(window);
+  });
+
+  OTServer otServer;
+  otServer.InitOTSender(socket);
+
+  bool otFailed = !SendInputLabels(otServer, delta, R, zeroLabels, nClientInputWires,
+                                   [&](uint64_t nDone) { progress.publish(nDone); });
+
+  if (otFailed) {
+    // the garbler must not wait for labels that will never come
+    progress.publish(nClientInputWires);
+    garbler.join();
+
+    ServerLog("OT failed");
+    delete[] zeroLabels;
+    delete[] outputMap;
+    return 0;
+  }
+
+  cout << "OT bytes sent: " << socket->GetBytesSent() << endl;
+  cout << "OT bytes received: " << socket->GetBytesReceived() << endl;
+  ServerLog("finished OT for input wires");
+
+  InputLabels inputLabels = new block[nServerInputWires];
+  extractLabels(inputLabels, &labelSource, input, nClientInputWires, nServerInputWires);
+  socket->SendLarge((byte*) inputLabels, nServerInputWires * sizeof(block));
+
+  garbler.join();
+  socket->SendLarge((byte*) outputMap, 2 * nOutputWires * sizeof(block));
+
+  cout << endl << "bytes sent: " << socket->GetBytesSent() + tableSocket->GetBytesSent() << endl;
+  cout << "bytes received: " << socket->GetBytesReceived() + tableSocket->GetBytesReceived() << endl;
+
+  uint32_t finished = 0;
+  socket->Receive(&finished, sizeof(finished));
+
+  delete[] zeroLabels;
+  delete[] outputMap;
+  delete[] inputLabels;
+
+  return finished;
+}
+
+// As RunClientProtocol, but the evaluator builds the circuit as it
+// evaluates it (see EvaluatingStream), on the tables as they arrive.
+void RunStreamedClientProtocol(Connection* connection, const StreamedOp& op, byte* input, int* outputVals,
+                               uint32_t nClientInputWires, long* nAndGates) {
+  CSocket* socket = &connection->socket;
+  uint32_t nInputWires = op.nInputWires;
+  uint32_t nOutputWires = op.nOutputWires;
+  uint32_t nServerInputWires = nInputWires - nClientInputWires;
+
+  block* inputLabels = new block[nInputWires];
+
+  // receive the keys and the tables while OT runs
+  CSocket* tableSocket = &connection->tableSocket;
+  BoundedQueue<bool> keysReceived(1);
+  TableWindows windows;
+  block fixedWiresSeed, globalKey;
+  long nTablesReceived = 0;
+  thread tableReceiver([&] {
+    uint32_t n, m;
+    tableSocket->Receive(&n, sizeof(n));
+    tableSocket->Receive(&m, sizeof(m));
+    if (n != nInputWires || m != nOutputWires) {
+      ClientLog("garbled circuit does not match the local circuit");
+      exit(1);
+    }
+    tableSocket->Receive(&fixedWiresSeed, sizeof(fixedWiresSeed));
+    tableSocket->Receive(&globalKey, sizeof(globalKey));
+    keysReceived.push(true);
+
+    int count;
+    tableSocket->Receive(&count, sizeof(count));
+    while (count > 0) {
+      windows.receive(tableSocket, count);
+      nTablesReceived += count;
+      tableSocket->Receive(&count, sizeof(count));
+    }
+    windows.finish();
+  });
+
+  OTClient otClient;
+  otClient.InitOTClient(socket);
+
+  ReceiveInputLabels(otClient, input, inputLabels, nClientInputWires);
+
   ClientLog("finished OT for input wires");
   cout << "OT bytes sent: " << socket->GetBytesSent() << endl;
   cout << "OT bytes received: " << socket->GetBytesReceived() << endl;
 
-   // prepare garbled circuit
   block *outputMap = new block[2 * nOutputWires];
   block *computedOutputMap = new block[nOutputWires];
 
-  socket->ReceiveLarge((byte*) (inputLabels + nClientInputWires), nClientInputWires * sizeof(block));
-  socket->ReceiveLarge((byte*) outputMap, 2 * nOutputWires * sizeof(block));
-  socket->ReceiveLarge((byte*) circuit.garbledTable, circuit.q * sizeof(GarbledTable));
-  socket->Receive(&circuit.nAndGates, sizeof(circuit.nAndGates));
-  socket->Receive(&circuit.fixedWiresSeed, sizeof(circuit.fixedWiresSeed));
-  socket->Receive(&circuit.globalKey, sizeof(circuit.globalKey));
+  socket->ReceiveLarge((byte*) (inputLabels + nClientInputWires), nServerInputWires * sizeof(block));
+  keysReceived.pop();
 
-  // garbled circuit evaluation  
-  evaluate(&circuit, inputLabels, computedOutputMap);
+  EvaluatingStream stream(nInputWires, nOutputWires, inputLabels, globalKey, fixedWiresSeed,
+                          [&](GarbledTable *tables, int count) { windows.read(tables, count); },
+                          computedOutputMap);
+  BuildStreamed(op, &stream);
+  windows.releaseWindow();
+  tableReceiver.join();
+
+  if (nTablesReceived != stream.getNumAndGates()) {
+    ClientLog("garbled circuit does not match the local circuit");
+    exit(1);
+  }
+  *nAndGates = stream.getNumAndGates();
+
+  socket->ReceiveLarge((byte*) outputMap, 2 * nOutputWires * sizeof(block));
   mapOutputs(outputMap, computedOutputMap, outputVals, nOutputWires);
 
   uint32_t finished = 1;
@@ -329,19 +1399,36 @@ void RunClientProtocol(CSocket* socket, GarbledCircuit& circuit, byte* input, in
   delete[] computedOutputMap;
 }
 
-void PrintStatistics(CSocket* socket, GarbledCircuit& circuit, double timeElapsed) {
-  cout << "Number of gates:     " << circuit.q << endl;
+// Prints the byte counts and times of both sockets.
+static void PrintNetworkStatistics(Connection* connection, double timeElapsed) {
+  CSocket* socket = &connection->socket;
+  CSocket* tableSocket = &connection->tableSocket;
+  uint64_t bytesSent = socket->GetBytesSent() + tableSocket->GetBytesSent();
+  uint64_t bytesReceived = socket->GetBytesReceived() + tableSocket->GetBytesReceived();
+  double networkTime = socket->GetNetworkTime() + tableSocket->GetNetworkTime();
+
+  cout << "bytes sent: " << bytesSent << endl;
+  cout << "bytes received: " << bytesReceived << endl;
+
+  cout << "total bytes: " << (bytesSent + bytesReceived) << endl << endl;
+
+  cout << "network communication time: " << networkTime << endl;
+  cout << "non-network execution time: " << (timeElapsed - networkTime) << endl;
+  cout << "total protocol execution time: " << timeElapsed << endl;
+}
+
+void PrintStatistics(Connection* connection, GarbledCircuit& circuit, double timeElapsed) {
+  cout << "Number of gates:     " << getNumGates(&circuit) << endl;
   cout << "Number of AND gates: " << circuit.nAndGates << endl;
   cout << "Number of wires:     " << circuit.r << endl << endl;
 
-  cout << "bytes sent: " << socket->GetBytesSent() << endl;
-  cout << "bytes received: " << socket->GetBytesReceived() << endl;
+  PrintNetworkStatistics(connection, timeElapsed);
+}
 
-  cout << "total bytes: " << (socket->GetBytesSent() + socket->GetBytesReceived()) << endl << endl;
+void PrintStatistics(Connection* connection, long nAndGates, double timeElapsed) {
+  cout << "Number of AND gates: " << nAndGates << endl << endl;
 
-  cout << "network communication time: " << socket->GetNetworkTime() << endl;
-  cout << "non-network execution time: " << (timeElapsed - socket->GetNetworkTime()) << endl;
-  cout << "total protocol execution time: " << timeElapsed << endl;
+  PrintNetworkStatistics(connection, timeElapsed);
 }
 
 bool ReadInputFile(byte* buf, const char* filename, int len) {
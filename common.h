@@ -21,11 +21,13 @@
 
 #include "GC/include/justGarble.h"
 #include "GC/include/circuits.h"
+#include "GC/include/stream.h"
 
 #include "OTExtension/protocol/OTClient.h"
 #include "OTExtension/protocol/OTServer.h"
 #include "OTExtension/util/cbitvector.h"
 
+#include <deque>
 #include <iomanip>
 #include <iostream>
 #include <openssl/sha.h>
@@ -36,43 +38,221 @@ using namespace std;
 
 typedef unsigned char byte;
 
+// The linear ARGMAX circuit compares the elements one after another, while
+// the tree circuit compares them pairwise in a tournament, with the same
+// number of AND gates but only logarithmic depth. Both output a bit for
+// every element that attains the max, followed by the max. The index
+// circuit instead outputs the index of the first element that attains the
+// max, in ArgMaxIndexBits(nElems) bits, followed by the max.
+enum ArgMaxCircuitType { ARGMAX_LINEAR, ARGMAX_TREE, ARGMAX_INDEX };
+
+// With a chunkSize, ARGMAX runs chunkSize elements at a time (see ArgMaxOp)
+// and outputs as ARGMAX_INDEX. If streamed, it builds the circuit while it
+// runs it (see StreamedArgMaxOp) and outputs as ARGMAX_LINEAR. shape selects
+// the adders and comparisons (see CircuitShape).
 struct ArgMaxArgs {
   uint32_t nElems;
   uint32_t nBits;
+  ArgMaxCircuitType type;
+  uint32_t chunkSize;
+  CircuitShape shape;
+  bool streamed;
 
-  ArgMaxArgs(uint32_t nElems, uint32_t nBits) : nElems(nElems), nBits(nBits) { }
+  ArgMaxArgs(uint32_t nElems, uint32_t nBits, ArgMaxCircuitType type, uint32_t chunkSize, CircuitShape shape,
+             bool streamed)
+    : nElems(nElems), nBits(nBits), type(type), chunkSize(chunkSize), shape(shape), streamed(streamed) { }
 };
 
+// The element-wise operations run chunkSize elements at a time (see
+// RunChunkedServerProtocol), or all at once if chunkSize is 0.
 struct BasicIntersectionArgs {
   uint32_t nElems;
+  uint32_t chunkSize;
 
-  BasicIntersectionArgs(uint32_t nElems) : nElems(nElems) { }
+  BasicIntersectionArgs(uint32_t nElems, uint32_t chunkSize) : nElems(nElems), chunkSize(chunkSize) { }
 };
 
 struct SetDiffArgs {
   uint32_t nElems;
   uint32_t nBits;
+  uint32_t chunkSize;
+
+  SetDiffArgs(uint32_t nElems, uint32_t nBits, uint32_t chunkSize)
+    : nElems(nElems), nBits(nBits), chunkSize(chunkSize) { }
+};
+
+// The evaluator (client) supplies the first input value of a Bristol circuit
+// and the garbler (server) supplies all of the others.
+struct BristolArgs {
+  GarbledCircuit* circuit;
+  uint32_t nClientInputWires;
+  vector<int> outputSizes;
 
-  SetDiffArgs(uint32_t nElems, uint32_t nBits) : nElems(nElems), nBits(nBits) { }
+  BristolArgs(GarbledCircuit* circuit, uint32_t nClientInputWires, const vector<int>& outputSizes)
+    : circuit(circuit), nClientInputWires(nClientInputWires), outputSizes(outputSizes) { }
 };
 
-void CreateArgMaxCircuit(GarbledCircuit& circuit, int nElems, int nBits);
+// Circuits are cached in this directory (relative to the working directory)
+// after they are first built, keyed by operation and size, and later runs
+// map them from there instead of building them again.
+#define CIRCUIT_CACHE_DIR "circuits"
+
+int ArgMaxIndexBits(int nElems);
+int ArgMaxOutputWires(int nElems, int nBits, ArgMaxCircuitType type);
+void CreateArgMaxCircuit(GarbledCircuit& circuit, int nElems, int nBits, ArgMaxCircuitType type = ARGMAX_LINEAR,
+                         CircuitShape shape = SHAPE_CHAIN);
 void CreateBasicIntersectionCircuit(GarbledCircuit& circuit, int nElems);
 void CreateSetDiffCircuit(GarbledCircuit& circuit, int nElems, int nBits);
 
-bool Listen(CSocket* socket, int port);
-bool Connect(CSocket* socket, const char* address, int port);
+// The server and the client talk over two connections: socket carries OT
+// and the small messages, and tableSocket carries the garbled tables, so
+// that the server can send tables while OT is still running on socket.
+struct Connection {
+  CSocket socket;
+  CSocket tableSocket;
+};
+
+// An element-wise operation, which can be run on chunks of elements as
+// independent circuits. Each party's input consists of fields, one after
+// another, where field f holds fieldBits[f] bits for every element in
+// order. The input of a chunk is the slice of every field for its
+// elements, and createCircuit(circuit, nChunkElems) creates the circuit
+// for it, which has outputBits outputs per element.
+//
+// An operation that reduces the elements (such as ARGMAX) instead carries
+// stateBits wires from one chunk to the next. The inputs of its circuit
+// are the client's input, then the state, then the server's input, and its
+// outputs are the state after the chunk. The state stays garbled between
+// chunks, and only the state after the last chunk is decoded. The server
+// supplies the state before the first chunk, as zeros.
+struct ChunkedOp {
+  vector<int> fieldBits;
+  int outputBits;
+  function<void(GarbledCircuit&, int)> createCircuit;
+  int stateBits;
+
+  ChunkedOp(const vector<int>& fieldBits, int outputBits, const function<void(GarbledCircuit&, int)>& createCircuit,
+            int stateBits = 0)
+    : fieldBits(fieldBits), outputBits(outputBits), createCircuit(createCircuit), stateBits(stateBits) { }
+};
+
+ChunkedOp BasicIntersectionOp();
+ChunkedOp SetDiffOp(int nBits);
+// The state of the chunked ARGMAX is the outputs of an ARGMAX_INDEX circuit
+// on all nElems elements, followed by ArgMaxIndexBits(nElems) bits that
+// count the elements so far (modulo a power of two).
+ChunkedOp ArgMaxOp(int nElems, int nBits, CircuitShape shape = SHAPE_CHAIN);
+
+// An operation whose circuit is built while it is garbled and evaluated
+// (see GateStream), for a circuit too large to hold. Its inputs are the
+// client's nInputWires - nServerInputWires wires and then the server's, and
+// build(circuit, context, stream) builds it into stream, handing over its
+// nOutputWires outputs with stream->output. Both parties run build, so it
+// must make the same calls to pin, keepOnly and output on both sides.
+struct StreamedOp {
+  uint32_t nInputWires;
+  uint32_t nOutputWires;
+  function<void(GarbledCircuit*, GarblingContext*, GateStream*)> build;
+
+  StreamedOp(uint32_t nInputWires, uint32_t nOutputWires,
+             const function<void(GarbledCircuit*, GarblingContext*, GateStream*)>& build)
+    : nInputWires(nInputWires), nOutputWires(nOutputWires), build(build) { }
+};
+
+// The ARGMAX_LINEAR circuit on nElems elements, streamed. The labels of the
+// sums of the shares stay resident, and otherwise only those written in
+// about the last STREAM_BUFFER_SIZE gates.
+StreamedOp StreamedArgMaxOp(int nElems, int nBits, CircuitShape shape = SHAPE_CHAIN);
+
+// Chunks of the chunked protocols wait between pipeline stages in queues
+// of at most this many chunks.
+#define CHUNK_QUEUE_DEPTH 2
+
+// The client receives the tables of a circuit during OT into windows of
+// TABLE_WINDOW_SIZE tables, and at most this many received windows wait
+// for the evaluator.
+#define TABLE_QUEUE_DEPTH 32
+
+// A queue between two threads that holds at most capacity items: push
+// waits while it is full and pop waits while it is empty.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity) { }
+
+  void push(T item) {
+    unique_lock<mutex> guard(lock);
+    notFull.wait(guard, [&] { return items.size() < capacity; });
+    items.push_back(item);
+    notEmpty.notify_one();
+  }
+
+  T pop() {
+    unique_lock<mutex> guard(lock);
+    notEmpty.wait(guard, [&] { return !items.empty(); });
+    T item = items.front();
+    items.pop_front();
+    notFull.notify_one();
+    return item;
+  }
+
+ private:
+  size_t capacity;
+  deque<T> items;
+  mutex lock;
+  condition_variable notFull, notEmpty;
+};
+
+bool Listen(Connection* connection, int port);
+bool Connect(Connection* connection, const char* address, int port);
 void StartServer(int port, byte* input, void* args,
-                 void (*RunProtocol)(CSocket*, byte*, void*));
+                 void (*RunProtocol)(Connection*, byte*, void*));
 void StartClient(const char *address, int port, byte* input, void* params,
-                 void (*RunProtocol)(CSocket*, byte*, void*));
+                 void (*RunProtocol)(Connection*, byte*, void*));
 
 void CreateChoiceVec(CBitVector& choices, byte* input, uint64_t len);
-uint32_t RunServerProtocol(CSocket* socket, GarbledCircuit& circuit, byte* input, uint32_t nInputWires,
+uint32_t RunServerProtocol(Connection* connection, GarbledCircuit& circuit, byte* input, uint32_t nInputWires,
                            uint32_t nServerInputWires);
-void RunClientProtocol(CSocket* socket, GarbledCircuit& circuit, byte* input, int* outputVals,
+void RunClientProtocol(Connection* connection, GarbledCircuit& circuit, byte* input, int* outputVals,
                        uint32_t nInputWires, uint32_t nClientInputWires, uint32_t nOutputWires);
-void PrintStatistics(CSocket* socket, GarbledCircuit& circuit, double timeElapsed);
+
+// Receives the decoded outputs of elements [first, first + count) of a
+// chunked operation, op.outputBits per element, as soon as their chunk has
+// been evaluated. Only RunChunkedClientProtocol takes one; RunClientProtocol
+// decodes all outputs at the end. It is called on the client's evaluator
+// thread, one chunk after another in order, while the protocol is still
+// running, so it should only record the outputs (the next chunk waits for
+// it), and outputVals is only valid during the call.
+typedef function<void(uint32_t first, uint32_t count, const int* outputVals)> ChunkResultCallback;
+
+// Run op on nElems elements, chunkSize elements at a time. Each chunk goes
+// through OT, garbling, sending, evaluation and decoding as a pipeline:
+// OT of the next chunks runs while earlier ones are garbled, sent and
+// evaluated, with at most CHUNK_QUEUE_DEPTH chunks waiting between stages,
+// so memory does not grow with nElems (except for the inputs and
+// outputs). The client's outputVals has op.outputBits per element, or the
+// op.stateBits of the final state. If onResults is set, the outputs of
+// every chunk are also handed to it as soon as they are decoded (except
+// for an op with state, which has no outputs per element), and outputVals
+// may then be NULL.
+uint32_t RunChunkedServerProtocol(Connection* connection, const ChunkedOp& op, byte* input,
+                                  uint32_t nElems, uint32_t chunkSize);
+void RunChunkedClientProtocol(Connection* connection, const ChunkedOp& op, byte* input, int* outputVals,
+                              uint32_t nElems, uint32_t chunkSize, long* nAndGates,
+                              const ChunkResultCallback& onResults = ChunkResultCallback());
+
+// Run op with its circuit built while it is garbled and evaluated, so that
+// at most STREAM_BUFFER_SIZE gates and TABLE_QUEUE_DEPTH + 1 windows of
+// tables are held on either side, and the labels that the builder keeps
+// (see GateStream). The client's nAndGates is set to the number of AND
+// gates of the circuit.
+uint32_t RunStreamedServerProtocol(Connection* connection, const StreamedOp& op, byte* input,
+                                   uint32_t nServerInputWires);
+void RunStreamedClientProtocol(Connection* connection, const StreamedOp& op, byte* input, int* outputVals,
+                               uint32_t nClientInputWires, long* nAndGates);
+
+void PrintStatistics(Connection* connection, GarbledCircuit& circuit, double timeElapsed);
+void PrintStatistics(Connection* connection, long nAndGates, double timeElapsed);
 
 static void PrintBlock(block& b) {
   cout << setw(24) << *((uint64_t*) &b) << " " << setw(24) << *(((uint64_t*) &b) + 1);